@@ -2,17 +2,86 @@
 
 #include <cstdint>
 #include <cstring>
+#include <functional>
 
 namespace bleb {
 
+// A single range of a vectored transfer
+struct ReadSegment {
+    uint64_t pos;
+    uint8_t* buffer;
+    size_t count;
+};
+
+struct WriteSegment {
+    uint64_t pos;
+    const uint8_t* buffer;
+    size_t count;
+};
+
 class ByteIO {
 public:
     virtual ~ByteIO() {}
     virtual void close() {}
+    virtual bool flush() { return true; }       // write out any data buffered by this ByteIO
     virtual uint64_t getSize() = 0;
     virtual bool getBytesAt(uint64_t pos, uint8_t* buffer, size_t count) = 0;
     virtual bool setBytesAt(uint64_t pos, const uint8_t* buffer, size_t count) = 0;
     virtual bool clearBytesAt(uint64_t pos, uint64_t count) = 0;
+
+    // The contents of the range are not needed anymore; backends may give the storage back (e.g. by punching a hole
+    // into the file). Afterwards, the range reads as either zeroes or the old data. Doing nothing is always correct.
+    virtual bool discardBytesAt(uint64_t /*pos*/, uint64_t /*count*/) { return true; }
+
+    // Cut off everything past `size`, which must not be more than the current size.
+    // Backends which can't shrink return false.
+    virtual bool truncate(uint64_t /*size*/) { return false; }
+
+    // Zero-copy access: returns a pointer directly into the backing storage, or nullptr if the backend can't provide
+    // one for the given range. The pointer is only valid until the ByteIO is modified or closed.
+    virtual const uint8_t* viewBytesAt(uint64_t /*pos*/, size_t /*count*/) { return nullptr; }
+
+    // Asynchronous reads: `completion` receives the result once the request has finished, at the latest during the
+    // next waitForCompletion(). Requests may be queued and only submitted in a batch. Backends without native support
+    // complete the request immediately. Returns false if the request couldn't be issued at all.
+    virtual bool getBytesAtAsync(uint64_t pos, uint8_t* buffer, size_t count, std::function<void(bool)> completion) {
+        completion(getBytesAt(pos, buffer, count));
+        return true;
+    }
+
+    // Submit all queued requests and block until every one of them has completed. This holds even if it fails, so
+    // completions may safely reference the caller's stack. Returns false if the backend ran into an error.
+    virtual bool waitForCompletion() { return true; }
+
+    // Vectored I/O: transfer any number of (possibly discontiguous) ranges in a single call. Succeeds only if all
+    // segments have been transferred completely. Segments of a single call must not overlap.
+    // By default, reads are issued through getBytesAtAsync (and thus batched by backends which support it) and writes
+    // are processed one by one.
+    // How many round trips this saves depends on the backend. preadv/pwritev take a single file offset, so
+    // PosixFdByteIO can only merge segments which are adjacent in the file; the spans of a fragmented stream still
+    // cost a system call each. IoUringByteIO submits any number of discontiguous segments in one batch.
+    virtual bool getBytesAtV(const ReadSegment* segments, size_t count) {
+        bool success = true;
+
+        for (size_t i = 0; i < count && success; i++) {
+            if (!getBytesAtAsync(segments[i].pos, segments[i].buffer, segments[i].count,
+                    [&success](bool result) { success = success && result; }))
+                success = false;
+        }
+
+        // must wait even after a failure, since the completions reference `success`; waitForCompletion only returns
+        // once every request has completed, whether or not it succeeded
+        return waitForCompletion() && success;
+    }
+
+    virtual bool setBytesAtV(const WriteSegment* segments, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            if (!setBytesAt(segments[i].pos, segments[i].buffer, segments[i].count))
+                return false;
+        }
+
+        return true;
+    }
 };
 
 // ByteIO
@@ -29,6 +98,18 @@ inline bool clearBytesAt(ByteIO* io, uint64_t pos, uint64_t count) {
     return io->clearBytesAt(pos, count);
 }
 
+inline bool getBytesAtV(ByteIO* io, const ReadSegment* segments, size_t count) {
+    return io->getBytesAtV(segments, count);
+}
+
+inline bool setBytesAtV(ByteIO* io, const WriteSegment* segments, size_t count) {
+    return io->setBytesAtV(segments, count);
+}
+
+inline const uint8_t* viewBytesAt(ByteIO* io, uint64_t pos, size_t count) {
+    return io->viewBytesAt(pos, count);
+}
+
 template <class Struct>
 bool retrieveStruct(ByteIO* io, uint64_t pos, Struct& st) {
     uint8_t buffer[Struct::SIZE];
@@ -0,0 +1,223 @@
+#ifndef bleb_byteio_cache_hpp
+#define bleb_byteio_cache_hpp
+
+#include <bleb/byteio.hpp>
+
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+namespace bleb {
+
+// Read cache decorator: keeps recently used, block-aligned chunks of the underlying ByteIO in memory (LRU order)
+// within a fixed memory budget. Writes go straight through to the backend and update cached blocks on the way.
+// Assumes exclusive access to the backend for the lifetime of the cache.
+class CachingByteIO : public ByteIO {
+public:
+    CachingByteIO(ByteIO* backend, size_t blockSize = 4096, size_t memoryBudget = 4 * 1024 * 1024)
+            : backend(backend), blockSize(blockSize) {
+        maxBlocks = std::max<size_t>(memoryBudget / blockSize, 1);
+        size = backend->getSize();
+    }
+
+    void close() override {
+        invalidate();
+        backend->close();
+    }
+
+    bool flush() override {
+        return backend->flush();
+    }
+
+    uint64_t getSize() override {
+        return size;
+    }
+
+    bool getBytesAt(uint64_t pos, uint8_t* buffer, size_t count) override {
+        if (pos + count > size)
+            return false;
+
+        // big reads would just flush the cache
+        if (count >= 4 * blockSize)
+            return backend->getBytesAt(pos, buffer, count);
+
+        while (count > 0) {
+            const uint64_t blockIndex = pos / blockSize;
+            const size_t offsetInBlock = (size_t)(pos % blockSize);
+            const size_t chunk = std::min(count, blockSize - offsetInBlock);
+
+            Block* block = getBlock(blockIndex, offsetInBlock + chunk);
+
+            if (!block)
+                return false;
+
+            memcpy(buffer, &block->data[offsetInBlock], chunk);
+
+            pos += chunk;
+            buffer += chunk;
+            count -= chunk;
+        }
+
+        return true;
+    }
+
+    bool setBytesAt(uint64_t pos, const uint8_t* buffer, size_t count) override {
+        if (!backend->setBytesAt(pos, buffer, count)) {
+            invalidate();
+            return false;
+        }
+
+        updateBlocks(pos, buffer, count);
+        return true;
+    }
+
+    bool clearBytesAt(uint64_t pos, uint64_t count) override {
+        if (!backend->clearBytesAt(pos, count)) {
+            invalidate();
+            return false;
+        }
+
+        updateBlocks(pos, nullptr, count);
+        return true;
+    }
+
+    bool truncate(uint64_t size) override {
+        const bool success = backend->truncate(size);
+        invalidate();
+        return success;
+    }
+
+    const uint8_t* viewBytesAt(uint64_t pos, size_t count) override {
+        return backend->viewBytesAt(pos, count);
+    }
+
+    // Drop all cached blocks
+    void invalidate() {
+        blocks.clear();
+        lru.clear();
+        size = backend->getSize();
+    }
+
+    uint64_t getHits() const { return hits; }
+    uint64_t getMisses() const { return misses; }
+    uint64_t getEvictions() const { return evictions; }
+
+    void resetCounters() { hits = misses = evictions = 0; }
+
+private:
+    struct Block {
+        uint64_t index;
+        size_t validLength;         // can be less than blockSize for the last block in file
+        std::unique_ptr<uint8_t[]> data;
+    };
+
+    // Look up a block, (re)loading it if it's not cached or doesn't contain at least `requiredLength` bytes
+    Block* getBlock(uint64_t blockIndex, size_t requiredLength) {
+        auto it = blocks.find(blockIndex);
+
+        if (it != blocks.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+
+            if (it->second->validLength >= requiredLength) {
+                hits++;
+                return &*it->second;
+            }
+        }
+        else {
+            if (blocks.size() >= maxBlocks) {
+                // evict least recently used; recycle its memory
+                lru.splice(lru.begin(), lru, std::prev(lru.end()));
+                blocks.erase(lru.front().index);
+                evictions++;
+            }
+            else {
+                lru.emplace_front();
+                lru.front().data.reset(new uint8_t[blockSize]);
+            }
+
+            lru.front().index = blockIndex;
+            it = blocks.emplace(blockIndex, lru.begin()).first;
+        }
+
+        misses++;
+
+        Block& block = *it->second;
+        const uint64_t blockPos = blockIndex * blockSize;
+        block.validLength = (size_t) std::min<uint64_t>(blockSize, size - blockPos);
+
+        if (!backend->getBytesAt(blockPos, &block.data[0], block.validLength)) {
+            lru.erase(it->second);
+            blocks.erase(it);
+            return nullptr;
+        }
+
+        return &block;
+    }
+
+    // Apply a write (or clear, if `buffer` is null) to any cached blocks it overlaps
+    void updateBlocks(uint64_t pos, const uint8_t* buffer, uint64_t count) {
+        size = std::max(size, pos + count);
+
+        if (blocks.empty())
+            return;
+
+        const uint64_t end = pos + count;
+
+        for (uint64_t blockIndex = pos / blockSize; blockIndex * blockSize < end; blockIndex++) {
+            auto it = blocks.find(blockIndex);
+
+            if (it == blocks.end()) {
+                // don't walk through huge ranges block by block if there's nothing to update
+                if (count / blockSize > blocks.size())
+                    return updateBlocksSparse(pos, buffer, count);
+
+                continue;
+            }
+
+            updateBlock(*it->second, pos, buffer, count);
+        }
+    }
+
+    void updateBlocksSparse(uint64_t pos, const uint8_t* buffer, uint64_t count) {
+        for (auto& block : lru) {
+            const uint64_t blockPos = block.index * blockSize;
+
+            if (blockPos < pos + count && blockPos + blockSize > pos)
+                updateBlock(block, pos, buffer, count);
+        }
+    }
+
+    void updateBlock(Block& block, uint64_t pos, const uint8_t* buffer, uint64_t count) {
+        const uint64_t blockPos = block.index * blockSize;
+        const uint64_t from = std::max(pos, blockPos);
+        const uint64_t to = std::min(pos + count, blockPos + blockSize);
+
+        const size_t offsetInBlock = (size_t)(from - blockPos);
+        const size_t length = (size_t)(to - from);
+
+        if (buffer)
+            memcpy(&block.data[offsetInBlock], buffer + (from - pos), length);
+        else
+            memset(&block.data[offsetInBlock], 0, length);
+
+        // a write can only extend the valid part if it is contiguous with it; otherwise the gap will be re-read
+        if (offsetInBlock <= block.validLength)
+            block.validLength = std::max(block.validLength, offsetInBlock + length);
+    }
+
+    ByteIO* backend;
+
+    size_t blockSize;
+    size_t maxBlocks;
+    uint64_t size;
+
+    std::list<Block> lru;
+    std::unordered_map<uint64_t, std::list<Block>::iterator> blocks;
+
+    uint64_t hits = 0, misses = 0, evictions = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef bleb_byteio_chunked_hpp
+#define bleb_byteio_chunked_hpp
+
+#include <bleb/byteio.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace bleb {
+
+// In-memory ByteIO made of fixed-size chunks. Unlike VectorByteIO, growing never moves existing data, so building
+// a big repository in memory costs O(1) amortized per byte appended. The contents can be exported as a list of
+// segments (one per chunk) or written to another ByteIO, e.g. a PosixFdByteIO, which will use pwritev.
+class ChunkedByteIO : public ByteIO {
+public:
+    ChunkedByteIO(size_t chunkSize = 64 * 1024) : chunkSize(chunkSize), size(0) {}
+
+    uint64_t getSize() override {
+        return size;
+    }
+
+    bool getBytesAt(uint64_t pos, uint8_t* buffer, size_t count) override {
+        if (pos + count > size)
+            return false;
+
+        forEachChunk(pos, count, [&buffer](uint8_t* chunkBytes, size_t length) {
+            memcpy(buffer, chunkBytes, length);
+            buffer += length;
+        });
+
+        return true;
+    }
+
+    bool setBytesAt(uint64_t pos, const uint8_t* buffer, size_t count) override {
+        if (!reserve(pos + count))
+            return false;
+
+        forEachChunk(pos, count, [&buffer](uint8_t* chunkBytes, size_t length) {
+            memcpy(chunkBytes, buffer, length);
+            buffer += length;
+        });
+
+        size = std::max<uint64_t>(size, pos + count);
+        return true;
+    }
+
+    bool clearBytesAt(uint64_t pos, uint64_t count) override {
+        if (!reserve(pos + count))
+            return false;
+
+        // chunks are allocated zeroed and never shrink, so everything past the end is zero already
+        if (pos < size) {
+            forEachChunk(pos, (size_t)(std::min<uint64_t>(pos + count, size) - pos),
+                    [](uint8_t* chunkBytes, size_t length) {
+                memset(chunkBytes, 0, length);
+            });
+        }
+
+        size = std::max<uint64_t>(size, pos + count);
+        return true;
+    }
+
+    bool truncate(uint64_t newSize) override {
+        if (newSize > size)
+            return false;
+
+        // keep the promise that everything past the end is zero
+        chunks.resize((size_t)((newSize + chunkSize - 1) / chunkSize));
+
+        if (newSize % chunkSize != 0) {
+            const size_t offsetInChunk = (size_t)(newSize % chunkSize);
+            memset(chunks.back().get() + offsetInChunk, 0, chunkSize - offsetInChunk);
+        }
+
+        size = newSize;
+        return true;
+    }
+
+    const uint8_t* viewBytesAt(uint64_t pos, size_t count) override {
+        if (count == 0 || pos + count > size || pos / chunkSize != (pos + count - 1) / chunkSize)
+            return nullptr;
+
+        return chunks[(size_t)(pos / chunkSize)].get() + pos % chunkSize;
+    }
+
+    // Describe the contents as a list of segments (in order, one per chunk) pointing into the chunks.
+    // The pointers stay valid until the ByteIO is destroyed.
+    void getSegments(std::vector<WriteSegment>& segments_out) {
+        segments_out.clear();
+
+        for (uint64_t pos = 0; pos < size; pos += chunkSize) {
+            segments_out.push_back(WriteSegment {pos, chunks[(size_t)(pos / chunkSize)].get(),
+                    (size_t) std::min<uint64_t>(chunkSize, size - pos)});
+        }
+    }
+
+    // Copy the whole contents to `dest` (at the same offsets) using a single vectored write
+    bool writeTo(ByteIO* dest) {
+        std::vector<WriteSegment> segments;
+        getSegments(segments);
+
+        return segments.empty() || dest->setBytesAtV(&segments[0], segments.size());
+    }
+
+private:
+    struct FreeDeleter {
+        void operator()(uint8_t* chunk) const { free(chunk); }
+    };
+
+    bool reserve(uint64_t requiredSize) {
+        const uint64_t requiredChunks = (requiredSize + chunkSize - 1) / chunkSize;
+
+        while (chunks.size() < requiredChunks) {
+            // calloc can usually hand out fresh zeroed pages without touching them
+            uint8_t* chunk = reinterpret_cast<uint8_t*>(calloc(chunkSize, 1));
+
+            if (!chunk)
+                return false;
+
+            chunks.emplace_back(chunk);
+        }
+
+        return true;
+    }
+
+    template <typename Function>
+    void forEachChunk(uint64_t pos, size_t count, Function function) {
+        while (count > 0) {
+            const size_t offsetInChunk = (size_t)(pos % chunkSize);
+            const size_t length = std::min(count, chunkSize - offsetInChunk);
+
+            function(chunks[(size_t)(pos / chunkSize)].get() + offsetInChunk, length);
+
+            pos += length;
+            count -= length;
+        }
+    }
+
+    size_t chunkSize;
+    uint64_t size;
+
+    std::vector<std::unique_ptr<uint8_t, FreeDeleter>> chunks;
+};
+
+}
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef bleb_byteio_direct_hpp
+#define bleb_byteio_direct_hpp
+
+#include <bleb/byteio_posix.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace bleb {
+
+// Direct I/O backend bypassing the page cache (O_DIRECT on Linux, F_NOCACHE on macOS), intended for big objects
+// which are written once and rarely read. Transfers which are aligned in the file, in length and in memory go
+// straight to the device; anything else is staged through an internal aligned bounce buffer.
+// Pair with Repository::setSpanDataAlignment to get aligned span data.
+// Unlike PosixFdByteIO, an instance must not be used from several threads at once (the bounce buffer is shared).
+// The file descriptor's flags are restored by close(), so a descriptor owned by the caller can be reused afterwards.
+class DirectFdByteIO : public PosixFdByteIO {
+public:
+    DirectFdByteIO(int fd, bool close, size_t alignment = 4096, size_t bounceBufferSize = 1024 * 1024)
+            : PosixFdByteIO(fd, close), alignment(alignment), bounceBuffer(nullptr), direct(false), originalFlags(0) {
+        bounceBufferSize = std::max(bounceBufferSize - bounceBufferSize % alignment, alignment);
+
+        if (posix_memalign(reinterpret_cast<void**>(&bounceBuffer), alignment, bounceBufferSize) != 0)
+            bounceBuffer = nullptr;
+        else
+            this->bounceBufferSize = bounceBufferSize;
+
+#if defined(O_DIRECT)
+        originalFlags = fcntl(fd, F_GETFL);
+        direct = (originalFlags >= 0 && fcntl(fd, F_SETFL, originalFlags | O_DIRECT) == 0);
+#elif defined(F_NOCACHE)
+        direct = (fcntl(fd, F_NOCACHE, 1) == 0);
+#endif
+    }
+
+    ~DirectFdByteIO() {
+        close();
+        free(bounceBuffer);
+    }
+
+    // false if the file system refused direct I/O; everything still works, just through the page cache
+    bool isDirect() const { return direct; }
+
+    void close() override {
+        if (getFd() >= 0)
+            flush();
+
+        if (direct && getFd() >= 0) {
+#if defined(O_DIRECT)
+            fcntl(getFd(), F_SETFL, originalFlags);
+#elif defined(F_NOCACHE)
+            fcntl(getFd(), F_NOCACHE, 0);
+#endif
+            direct = false;
+        }
+
+        PosixFdByteIO::close();
+    }
+
+    // Writes are done in whole blocks, so the file can temporarily be longer than getSize(); this trims it
+    bool flush() override {
+        struct stat st;
+
+        if (fstat(getFd(), &st) == 0 && (uint64_t) st.st_size > getSize())
+            return ftruncate(getFd(), (off_t) getSize()) == 0;
+
+        return true;
+    }
+
+    bool getBytesAt(uint64_t pos, uint8_t* buffer, size_t count) override {
+        if (pos + count > getSize())
+            return false;
+
+        return transfer(pos, buffer, nullptr, count);
+    }
+
+    bool setBytesAt(uint64_t pos, const uint8_t* buffer, size_t count) override {
+        if (!transfer(pos, nullptr, buffer, count))
+            return false;
+
+        growSize(pos + count);
+        return true;
+    }
+
+    // PosixFdByteIO's preadv/pwritev path knows nothing about alignment
+    bool getBytesAtV(const ReadSegment* segments, size_t count) override {
+        return ByteIO::getBytesAtV(segments, count);
+    }
+
+    bool setBytesAtV(const WriteSegment* segments, size_t count) override {
+        return ByteIO::setBytesAtV(segments, count);
+    }
+
+private:
+    DirectFdByteIO(const DirectFdByteIO&) = delete;
+
+    bool isAligned(uint64_t value) const { return value % alignment == 0; }
+
+    // Read into `readBuffer` or write from `writeBuffer` (exactly one of them must be set)
+    bool transfer(uint64_t pos, uint8_t* readBuffer, const uint8_t* writeBuffer, size_t count) {
+        while (count > 0) {
+            const uint8_t* memory = readBuffer ? readBuffer : writeBuffer;
+
+            // fast path: everything aligned, no copy needed
+            if (isAligned(pos) && count >= alignment && isAligned((uintptr_t) memory)) {
+                const size_t length = count - count % alignment;
+
+                if (readBuffer) {
+                    if (!readFully(pos, readBuffer, length))
+                        return false;
+
+                    readBuffer += length;
+                }
+                else {
+                    if (!writeFully(pos, writeBuffer, length))
+                        return false;
+
+                    writeBuffer += length;
+                }
+
+                pos += length;
+                count -= length;
+                continue;
+            }
+
+            if (!bounceBuffer)
+                return false;
+
+            // stage up to a bounce buffer worth of blocks
+            const uint64_t blockStart = pos - pos % alignment;
+            const size_t offset = (size_t)(pos - blockStart);
+            const size_t length = std::min(count, bounceBufferSize - offset);
+            const size_t blocksLength = (size_t) std::min<uint64_t>(bounceBufferSize,
+                    (offset + length + alignment - 1) / alignment * alignment);
+
+            if (readBuffer || offset != 0 || length != blocksLength) {
+                // reading, or partially overwriting blocks which need to be read first
+                if (!readBlocks(blockStart, blocksLength))
+                    return false;
+            }
+
+            if (readBuffer) {
+                memcpy(readBuffer, bounceBuffer + offset, length);
+                readBuffer += length;
+            }
+            else {
+                memcpy(bounceBuffer + offset, writeBuffer, length);
+                writeBuffer += length;
+
+                // this might write past the logical end of file; flush() trims it
+                if (!writeFully(blockStart, bounceBuffer, blocksLength))
+                    return false;
+            }
+
+            pos += length;
+            count -= length;
+        }
+
+        return true;
+    }
+
+    // Read whole blocks into the bounce buffer; anything past the physical end of file reads as zeroes
+    bool readBlocks(uint64_t blockStart, size_t blocksLength) {
+        size_t got = 0;
+
+        while (got < blocksLength) {
+            ssize_t result = pread(getFd(), bounceBuffer + got, blocksLength - got, (off_t)(blockStart + got));
+
+            if (result < 0 && errno == EINTR)
+                continue;
+            else if (result < 0)
+                return false;
+
+            got += result;
+
+            // a short read means end of file (and the next offset wouldn't be aligned anyway)
+            if (result == 0 || got % alignment != 0)
+                break;
+        }
+
+        memset(bounceBuffer + got, 0, blocksLength - got);
+        return true;
+    }
+
+    size_t alignment;
+
+    uint8_t* bounceBuffer;
+    size_t bounceBufferSize = 0;
+
+    bool direct;
+    int originalFlags;
+};
+
+}
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef bleb_byteio_mmap_hpp
+#define bleb_byteio_mmap_hpp
+
+#include <bleb/byteio.hpp>
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace bleb {
+
+// Read-only view of a whole file mapped into memory.
+// Reads are plain memcpy and viewBytesAt hands out pointers straight into the mapping.
+class MmapByteIO : public ByteIO {
+public:
+    static int getFile(const char* path) {
+        return ::open(path, O_RDONLY);
+    }
+
+    MmapByteIO(int fd, bool close) : fd(fd), close_(close), mapping(nullptr), size(0) {
+        struct stat st;
+
+        if (fstat(fd, &st) != 0 || st.st_size <= 0)
+            return;
+
+        void* mapped = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (mapped == MAP_FAILED)
+            return;
+
+        mapping = reinterpret_cast<const uint8_t*>(mapped);
+        size = (uint64_t) st.st_size;
+    }
+
+    ~MmapByteIO() {
+        close();
+    }
+
+    // An empty file is valid, but doesn't get mapped
+    bool isMapped() const { return mapping != nullptr; }
+
+    void close() override {
+        if (mapping) {
+            munmap(const_cast<uint8_t*>(mapping), (size_t) size);
+            mapping = nullptr;
+            size = 0;
+        }
+
+        if (close_ && fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    uint64_t getSize() override {
+        return size;
+    }
+
+    bool getBytesAt(uint64_t pos, uint8_t* buffer, size_t count) override {
+        if (pos + count > size)
+            return false;
+
+        memcpy(buffer, mapping + pos, count);
+        return true;
+    }
+
+    bool setBytesAt(uint64_t /*pos*/, const uint8_t* /*buffer*/, size_t /*count*/) override {
+        return false;
+    }
+
+    bool clearBytesAt(uint64_t /*pos*/, uint64_t /*count*/) override {
+        return false;
+    }
+
+    const uint8_t* viewBytesAt(uint64_t pos, size_t count) override {
+        if (count == 0 || pos + count > size)
+            return nullptr;
+
+        return mapping + pos;
+    }
+
+private:
+    int fd;
+    bool close_;
+
+    const uint8_t* mapping;
+    uint64_t size;
+};
+
+// Read/write mapping of a file. Writes are plain memcpy/memset into the mapping, which grows geometrically
+// (using mremap where available) as data is appended. The file is kept at the size of the mapping while open
+// and trimmed to its logical size on close(); if that fails, the file just keeps some trailing zeroes and
+// isTrimmed() returns false. flush() commits the data to disk with msync.
+// Growing the mapping can move it, which invalidates any pointers obtained through viewBytesAt.
+class WritableMmapByteIO : public ByteIO {
+public:
+    static int getFile(const char* path, bool canCreateNew) {
+        int fd = ::open(path, O_RDWR);
+
+        if (fd < 0 && canCreateNew)
+            fd = ::open(path, O_RDWR | O_CREAT, 0666);
+
+        return fd;
+    }
+
+    WritableMmapByteIO(int fd, bool close, size_t initialCapacity = 64 * 1024)
+            : fd(fd), close_(close), mapping(nullptr), capacity(0), size(0), trimmed(true) {
+        struct stat st;
+
+        if (fstat(fd, &st) != 0)
+            return;
+
+        size = (uint64_t) st.st_size;
+        reserve(std::max<uint64_t>(size, initialCapacity));
+    }
+
+    ~WritableMmapByteIO() {
+        close();
+    }
+
+    bool isMapped() const { return mapping != nullptr; }
+    bool isTrimmed() const { return trimmed; }
+
+    void close() override {
+        if (mapping) {
+            munmap(mapping, (size_t) capacity);
+            mapping = nullptr;
+            capacity = 0;
+
+            trimmed = (ftruncate(fd, (off_t) size) == 0);
+        }
+
+        if (close_ && fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    bool flush() override {
+        return !mapping || msync(mapping, (size_t) size, MS_SYNC) == 0;
+    }
+
+    uint64_t getSize() override {
+        return size;
+    }
+
+    bool getBytesAt(uint64_t pos, uint8_t* buffer, size_t count) override {
+        if (pos + count > size)
+            return false;
+
+        memcpy(buffer, mapping + pos, count);
+        return true;
+    }
+
+    bool setBytesAt(uint64_t pos, const uint8_t* buffer, size_t count) override {
+        if (!reserve(pos + count))
+            return false;
+
+        memcpy(mapping + pos, buffer, count);
+        size = std::max<uint64_t>(size, pos + count);
+        return true;
+    }
+
+    bool clearBytesAt(uint64_t pos, uint64_t count) override {
+        if (!reserve(pos + count))
+            return false;
+
+        // everything past the logical end is known to be zero already; don't touch those pages
+        if (pos < size)
+            memset(mapping + pos, 0, (size_t)(std::min<uint64_t>(pos + count, size) - pos));
+
+        size = std::max<uint64_t>(size, pos + count);
+        return true;
+    }
+
+    // The file itself is trimmed on close()
+    bool truncate(uint64_t newSize) override {
+        if (newSize > size)
+            return false;
+
+        // clearBytesAt relies on everything past the logical end being zero
+        memset(mapping + newSize, 0, (size_t)(size - newSize));
+        size = newSize;
+        return true;
+    }
+
+    const uint8_t* viewBytesAt(uint64_t pos, size_t count) override {
+        if (count == 0 || pos + count > size)
+            return nullptr;
+
+        return mapping + pos;
+    }
+
+    // Make sure the mapping covers at least `requiredCapacity` bytes
+    bool reserve(uint64_t requiredCapacity) {
+        if (requiredCapacity <= capacity && mapping)
+            return true;
+
+        const uint64_t pageSize = (uint64_t) sysconf(_SC_PAGESIZE);
+        uint64_t newCapacity = std::max<uint64_t>(std::max<uint64_t>(requiredCapacity, capacity * 2), pageSize);
+        newCapacity = (newCapacity + pageSize - 1) / pageSize * pageSize;
+
+        // the file must be at least as big as the mapping; the new range reads as zeroes
+        if (ftruncate(fd, (off_t) newCapacity) != 0)
+            return false;
+
+        void* mapped;
+
+#ifdef MREMAP_MAYMOVE
+        if (mapping) {
+            mapped = mremap(mapping, (size_t) capacity, (size_t) newCapacity, MREMAP_MAYMOVE);
+
+            // the old mapping stays valid if this fails
+            if (mapped == MAP_FAILED)
+                return false;
+        }
+        else
+            mapped = mmap(nullptr, (size_t) newCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+#else
+        if (mapping)
+            munmap(mapping, (size_t) capacity);
+
+        mapped = mmap(nullptr, (size_t) newCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+#endif
+
+        if (mapped == MAP_FAILED) {
+            mapping = nullptr;
+            capacity = 0;
+            return false;
+        }
+
+        mapping = reinterpret_cast<uint8_t*>(mapped);
+        capacity = newCapacity;
+        return true;
+    }
+
+private:
+    WritableMmapByteIO(const WritableMmapByteIO&) = delete;
+
+    int fd;
+    bool close_;
+
+    uint8_t* mapping;
+    uint64_t capacity;
+    uint64_t size;
+    bool trimmed;
+};
+
+}
+
+#endif
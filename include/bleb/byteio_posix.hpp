@@ -0,0 +1,251 @@
+#ifndef bleb_byteio_posix_hpp
+#define bleb_byteio_posix_hpp
+
+#include <bleb/byteio.hpp>
+
+#include <atomic>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace bleb {
+
+// File descriptor backend built on positional I/O (pread/pwrite).
+// There is no shared file position, so any number of threads may read through the same instance concurrently.
+// The file size is cached; the file must not be resized behind our back.
+class PosixFdByteIO : public ByteIO {
+public:
+    static int getFile(const char* path, bool canCreateNew) {
+        int fd = ::open(path, O_RDWR);
+
+        if (fd < 0 && canCreateNew)
+            fd = ::open(path, O_RDWR | O_CREAT, 0666);
+
+        return fd;
+    }
+
+    PosixFdByteIO(int fd, bool close) : fd(fd), close_(close), size(0) {
+        struct stat st;
+
+        if (fstat(fd, &st) == 0)
+            size = (uint64_t) st.st_size;
+    }
+
+    ~PosixFdByteIO() {
+        close();
+    }
+
+    void close() override {
+        if (close_ && fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    uint64_t getSize() override {
+        return size.load(std::memory_order_acquire);
+    }
+
+    bool getBytesAt(uint64_t pos, uint8_t* buffer, size_t count) override {
+        return readFully(pos, buffer, count);
+    }
+
+    bool setBytesAt(uint64_t pos, const uint8_t* buffer, size_t count) override {
+        if (!writeFully(pos, buffer, count))
+            return false;
+
+        growSize(pos + count);
+        return true;
+    }
+
+    // Extending the file is done without writing any data (the new range is allocated, but reads as zeroes).
+    // Ranges inside the file are overwritten, so that they stay allocated; see discardBytesAt for deallocation.
+    bool clearBytesAt(uint64_t pos, uint64_t count) override {
+        const uint64_t end = pos + count;
+        const uint64_t currentSize = getSize();
+
+        if (end > currentSize) {
+            if (!extendTo(end))
+                return writeZeroes(pos, count);
+
+            count = (pos < currentSize) ? currentSize - pos : 0;
+        }
+
+        if (count == 0)
+            return true;
+
+        return writeZeroes(pos, count);
+    }
+
+#ifdef __linux__
+    // Big ranges are deallocated where the filesystem supports it; if it doesn't, the data just stays
+    bool discardBytesAt(uint64_t pos, uint64_t count) override {
+        if (count >= kMinPunchHoleLength && pos + count <= getSize())
+            fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t) pos, (off_t) count);
+
+        return true;
+    }
+#endif
+
+    // Unlike the rest, this must not race with writes
+    bool truncate(uint64_t newSize) override {
+        if (newSize > getSize() || ftruncate(fd, (off_t) newSize) != 0)
+            return false;
+
+        size.store(newSize, std::memory_order_release);
+        return true;
+    }
+
+#ifdef __linux__
+    // Runs of segments which are contiguous in the file are transferred with a single preadv/pwritev; any other
+    // segment still takes a pread/pwrite of its own (use IoUringByteIO to batch those)
+    bool getBytesAtV(const ReadSegment* segments, size_t count) override {
+        return transferV(segments, count, [this](const ReadSegment& segment) {
+            return getBytesAt(segment.pos, segment.buffer, segment.count);
+        }, [this](const iovec* iov, int iovcnt, uint64_t pos) {
+            return preadv(fd, iov, iovcnt, (off_t) pos);
+        });
+    }
+
+    bool setBytesAtV(const WriteSegment* segments, size_t count) override {
+        return transferV(segments, count, [this](const WriteSegment& segment) {
+            return setBytesAt(segment.pos, segment.buffer, segment.count);
+        }, [this](const iovec* iov, int iovcnt, uint64_t pos) {
+            ssize_t written = pwritev(fd, iov, iovcnt, (off_t) pos);
+
+            if (written > 0)
+                growSize(pos + written);
+
+            return written;
+        });
+    }
+#endif
+
+    int getFd() const { return fd; }
+
+protected:
+    enum { kMinPunchHoleLength = 64 * 1024 };
+
+    bool readFully(uint64_t pos, uint8_t* buffer, size_t count) {
+        while (count > 0) {
+            ssize_t got = pread(fd, buffer, count, (off_t) pos);
+
+            if (got < 0 && errno == EINTR)
+                continue;
+            else if (got <= 0)
+                return false;
+
+            pos += got;
+            buffer += got;
+            count -= got;
+        }
+
+        return true;
+    }
+
+    bool writeFully(uint64_t pos, const uint8_t* buffer, size_t count) {
+        while (count > 0) {
+            ssize_t written = pwrite(fd, buffer, count, (off_t) pos);
+
+            if (written < 0 && errno == EINTR)
+                continue;
+            else if (written <= 0)
+                return false;
+
+            pos += written;
+            buffer += written;
+            count -= written;
+        }
+
+        return true;
+    }
+
+    bool extendTo(uint64_t newSize) {
+#ifdef __linux__
+        // prefer actually reserving the blocks; fall back to a sparse file if the filesystem can't do that
+        const uint64_t currentSize = getSize();
+
+        if (fallocate(fd, 0, (off_t) currentSize, (off_t)(newSize - currentSize)) != 0
+                && ftruncate(fd, (off_t) newSize) != 0)
+            return false;
+#else
+        if (ftruncate(fd, (off_t) newSize) != 0)
+            return false;
+#endif
+
+        growSize(newSize);
+        return true;
+    }
+
+    bool writeZeroes(uint64_t pos, uint64_t count) {
+        static const uint8_t empty[4096] = {};
+
+        while (count > sizeof(empty)) {
+            if (!setBytesAt(pos, empty, sizeof(empty)))
+                return false;
+
+            pos += sizeof(empty);
+            count -= sizeof(empty);
+        }
+
+        return setBytesAt(pos, empty, (size_t) count);
+    }
+
+    void growSize(uint64_t end) {
+        uint64_t current = size.load(std::memory_order_relaxed);
+
+        while (end > current && !size.compare_exchange_weak(current, end, std::memory_order_acq_rel))
+            ;
+    }
+
+private:
+#ifdef __linux__
+    template <typename Segment, typename TransferOne, typename TransferRun>
+    bool transferV(const Segment* segments, size_t count, TransferOne transferOne, TransferRun transferRun) {
+        enum { kMaxRunLength = 64 };
+
+        for (size_t i = 0; i < count; ) {
+            iovec iov[kMaxRunLength];
+            size_t runLength = 0;
+            uint64_t runBytes = 0;
+
+            do {
+                iov[runLength].iov_base = const_cast<uint8_t*>(segments[i + runLength].buffer);
+                iov[runLength].iov_len = segments[i + runLength].count;
+                runBytes += segments[i + runLength].count;
+                runLength++;
+            } while (i + runLength < count && runLength < kMaxRunLength
+                    && segments[i + runLength].pos == segments[i + runLength - 1].pos + segments[i + runLength - 1].count);
+
+            ssize_t transferred = -1;
+
+            if (runLength > 1)
+                transferred = transferRun(iov, (int) runLength, segments[i].pos);
+
+            // a single segment, or a short/failed transfer: (re)do the run segment by segment
+            if (transferred < 0 || (uint64_t) transferred != runBytes) {
+                for (size_t j = i; j < i + runLength; j++) {
+                    if (!transferOne(segments[j]))
+                        return false;
+                }
+            }
+
+            i += runLength;
+        }
+
+        return true;
+    }
+#endif
+
+    int fd;
+    bool close_;
+
+    std::atomic<uint64_t> size;
+};
+
+}
+
+#endif
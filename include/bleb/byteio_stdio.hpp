@@ -4,6 +4,10 @@
 
 #include <cstdio>
 
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
 namespace bleb {
 class StdioFileByteIO : public ByteIO {
 public:
@@ -29,6 +33,10 @@ public:
         }
     }
 
+    virtual bool flush() override {
+        return fflush(file) == 0;
+    }
+
     virtual uint64_t getSize() override {
         fseek(file, 0, SEEK_END);
         return ftell(file);
@@ -47,6 +55,18 @@ public:
     virtual bool clearBytesAt(uint64_t pos, uint64_t count) override {
         static const uint8_t empty[256] = {};
 
+#ifndef _WIN32
+        // growing the file doesn't require writing anything
+        const uint64_t size = getSize();
+
+        if (pos + count > size && fflush(file) == 0 && ftruncate(fileno(file), (off_t)(pos + count)) == 0) {
+            if (pos >= size)
+                return true;
+
+            count = size - pos;
+        }
+#endif
+
         while (count > sizeof(empty)) {
             if (!setBytesAt(pos, empty, sizeof(empty)))
                 return false;
@@ -61,6 +81,14 @@ public:
         return true;
     }
 
+    virtual bool truncate(uint64_t size) override {
+#ifndef _WIN32
+        return size <= getSize() && fflush(file) == 0 && ftruncate(fileno(file), (off_t) size) == 0;
+#else
+        return false;
+#endif
+    }
+
     FILE* file;
     bool close_;
 };
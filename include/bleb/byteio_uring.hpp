@@ -0,0 +1,60 @@
+#ifndef bleb_byteio_uring_hpp
+#define bleb_byteio_uring_hpp
+
+#ifdef __linux__
+
+#include <bleb/byteio_posix.hpp>
+
+#include <memory>
+
+namespace bleb {
+
+// Linux io_uring backend. Synchronous calls behave exactly like PosixFdByteIO; getBytesAtAsync queues reads in the
+// submission ring, which are then submitted together (one syscall per batch) by waitForCompletion.
+// Vectored reads and writes are submitted as a single batch as well.
+// If the kernel doesn't provide io_uring, all requests silently fall back to pread. The same happens if
+// io_uring_enter fails later on, after all requests already submitted to the kernel have been waited for.
+// Unlike PosixFdByteIO, the asynchronous API must not be used from several threads at once.
+class IoUringByteIO : public PosixFdByteIO {
+public:
+    IoUringByteIO(int fd, bool close, unsigned int queueDepth = 64);
+    ~IoUringByteIO();
+
+    bool hasRing() const { return ring != nullptr; }
+
+    // Number of requests which have been queued in the submission ring (as opposed to done synchronously), and of
+    // io_uring_enter calls it took to submit them and wait for them
+    uint64_t getNumRingRequests() const;
+    uint64_t getNumSubmissions() const;
+
+    void close() override;
+
+    bool getBytesAtAsync(uint64_t pos, uint8_t* buffer, size_t count, std::function<void(bool)> completion) override;
+    bool waitForCompletion() override;
+
+    bool getBytesAtV(const ReadSegment* segments, size_t count) override;
+    bool setBytesAtV(const WriteSegment* segments, size_t count) override;
+
+private:
+    IoUringByteIO(const IoUringByteIO&) = delete;
+
+    struct Ring;
+
+    enum { kMaxEnterRetries = 1000 };
+
+    bool makeRoom();
+    void queueRequest(uint8_t opcode, uint64_t pos, uint8_t* buffer, size_t count,
+            std::function<void(bool)> completion);
+    bool enter(unsigned int minComplete);
+    void failRing();
+    static void backOff(unsigned int attempt);
+    unsigned int reapCompletions();
+
+    std::unique_ptr<Ring> ring;
+};
+
+}
+
+#endif
+
+#endif
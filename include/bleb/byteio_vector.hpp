@@ -51,6 +51,21 @@ public:
         return true;
     }
 
+    bool truncate(uint64_t size) override {
+        if (size > bytes.size())
+            return false;
+
+        bytes.resize(size);
+        return true;
+    }
+
+    const uint8_t* viewBytesAt(uint64_t pos, size_t count) override {
+        if (count == 0 || pos + count > bytes.size())
+            return nullptr;
+
+        return &bytes[pos];
+    }
+
 private:
     std::vector<uint8_t> bytes;
     bool allowExpansion;
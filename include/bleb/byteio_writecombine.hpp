@@ -0,0 +1,238 @@
+#ifndef bleb_byteio_writecombine_hpp
+#define bleb_byteio_writecombine_hpp
+
+#include <bleb/byteio.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <vector>
+
+namespace bleb {
+
+// Write buffering decorator: collects writes in memory, merging overlapping and adjacent ranges, and only passes
+// them on to the backend (in ascending order) on flush(), close() or once `maxBufferedBytes` is exceeded.
+// Reads see the buffered data. Assumes exclusive access to the backend.
+// Ranges the backend fails to write stay buffered, so flush() can be retried. close() and the destructor have no way
+// to report such a failure, so call flush() before them if it matters.
+class WriteCombiningByteIO : public ByteIO {
+public:
+    WriteCombiningByteIO(ByteIO* backend, size_t maxBufferedBytes = 4 * 1024 * 1024)
+            : backend(backend), maxBufferedBytes(maxBufferedBytes), bufferedBytes(0) {
+        backendSize = backend->getSize();
+    }
+
+    ~WriteCombiningByteIO() {
+        if (!dirty.empty())
+            flush();
+    }
+
+    void close() override {
+        flush();
+        backend->close();
+    }
+
+    bool flush() override {
+        bool success = true;
+
+        for (auto it = dirty.begin(); it != dirty.end(); ) {
+            if (!backend->setBytesAt(it->first, &it->second[0], it->second.size())) {
+                success = false;
+                ++it;
+                continue;
+            }
+
+            bufferedBytes -= it->second.size();
+            it = dirty.erase(it);
+        }
+
+        backendSize = backend->getSize();
+
+        return backend->flush() && success;
+    }
+
+    uint64_t getSize() override {
+        if (dirty.empty())
+            return backendSize;
+
+        auto last = std::prev(dirty.end());
+        return std::max(backendSize, last->first + last->second.size());
+    }
+
+    bool getBytesAt(uint64_t pos, uint8_t* buffer, size_t count) override {
+        if (pos + count > getSize())
+            return false;
+
+        const uint64_t end = pos + count;
+
+        // start with the last range beginning at or before `pos`, it might overlap
+        auto it = dirty.upper_bound(pos);
+
+        if (it != dirty.begin())
+            --it;
+
+        while (pos < end) {
+            // skip ranges entirely before `pos`
+            while (it != dirty.end() && it->first + it->second.size() <= pos)
+                ++it;
+
+            if (it != dirty.end() && it->first <= pos) {
+                // `pos` is within a buffered range
+                const size_t offset = (size_t)(pos - it->first);
+                const size_t length = (size_t) std::min<uint64_t>(it->second.size() - offset, end - pos);
+
+                memcpy(buffer, &it->second[offset], length);
+                pos += length;
+                buffer += length;
+                continue;
+            }
+
+            // read from the backend up to the next buffered range
+            const uint64_t gapEnd = (it != dirty.end()) ? std::min(end, it->first) : end;
+            const size_t length = (size_t)(gapEnd - pos);
+
+            // anything between the backend's end of file and a buffered range reads as zeroes
+            const size_t fromBackend = (size_t) std::min<uint64_t>(length, backendSize > pos ? backendSize - pos : 0);
+
+            if (fromBackend && !backend->getBytesAt(pos, buffer, fromBackend))
+                return false;
+
+            memset(buffer + fromBackend, 0, length - fromBackend);
+            pos += length;
+            buffer += length;
+        }
+
+        return true;
+    }
+
+    bool setBytesAt(uint64_t pos, const uint8_t* buffer, size_t count) override {
+        if (count == 0)
+            return true;
+
+        bufferWrite(pos, buffer, count);
+
+        if (bufferedBytes > maxBufferedBytes)
+            return flush();
+
+        return true;
+    }
+
+    bool clearBytesAt(uint64_t pos, uint64_t count) override {
+        // small clears (such as padding) are combined like any other write, big ones go to the backend directly
+        if (count <= maxBufferedBytes / 16) {
+            static const uint8_t empty[4096] = {};
+
+            while (count > 0) {
+                const size_t length = (size_t) std::min<uint64_t>(count, sizeof(empty));
+
+                if (!setBytesAt(pos, empty, length))
+                    return false;
+
+                pos += length;
+                count -= length;
+            }
+
+            return true;
+        }
+
+        if (!flush() || !backend->clearBytesAt(pos, count))
+            return false;
+
+        backendSize = backend->getSize();
+        return true;
+    }
+
+    bool truncate(uint64_t size) override {
+        if (!flush() || !backend->truncate(size))
+            return false;
+
+        backendSize = backend->getSize();
+        return true;
+    }
+
+    const uint8_t* viewBytesAt(uint64_t pos, size_t count) override {
+        // can't point into the backend if its contents are stale
+        auto it = dirty.lower_bound(pos + count);
+
+        if (it != dirty.begin() && std::prev(it)->first + std::prev(it)->second.size() > pos)
+            return nullptr;
+
+        return backend->viewBytesAt(pos, count);
+    }
+
+    size_t getBufferedBytes() const { return bufferedBytes; }
+
+private:
+    void bufferWrite(uint64_t pos, const uint8_t* buffer, size_t count) {
+        const uint64_t end = pos + count;
+
+        // find the first range which overlaps or touches [pos, end)
+        auto first = dirty.upper_bound(pos);
+
+        if (first != dirty.begin() && std::prev(first)->first + std::prev(first)->second.size() >= pos)
+            --first;
+
+        // ...and the end of all such ranges
+        auto last = first;
+        uint64_t mergedEnd = end;
+
+        while (last != dirty.end() && last->first <= end) {
+            mergedEnd = std::max<uint64_t>(mergedEnd, last->first + last->second.size());
+            ++last;
+        }
+
+        if (first == last) {
+            // nothing to merge with
+            dirty.emplace(pos, std::vector<uint8_t>(buffer, buffer + count));
+            bufferedBytes += count;
+            return;
+        }
+
+        if (first->first <= pos) {
+            // the common case: extend the first range (e.g. sequential writes)
+            std::vector<uint8_t>& merged = first->second;
+            const uint64_t mergedStart = first->first;
+
+            bufferedBytes -= merged.size();
+            merged.resize((size_t)(mergedEnd - mergedStart));
+
+            for (auto it = std::next(first); it != last; ++it)
+                memcpy(&merged[(size_t)(it->first - mergedStart)], &it->second[0], it->second.size());
+
+            memcpy(&merged[(size_t)(pos - mergedStart)], buffer, count);
+            bufferedBytes += merged.size();
+
+            for (auto it = std::next(first); it != last; ) {
+                bufferedBytes -= it->second.size();
+                it = dirty.erase(it);
+            }
+        }
+        else {
+            // the new write starts before any of the ranges it merges with
+            std::vector<uint8_t> merged((size_t)(mergedEnd - pos));
+
+            for (auto it = first; it != last; ) {
+                memcpy(&merged[(size_t)(it->first - pos)], &it->second[0], it->second.size());
+                bufferedBytes -= it->second.size();
+                it = dirty.erase(it);
+            }
+
+            memcpy(&merged[0], buffer, count);
+            bufferedBytes += merged.size();
+
+            dirty.emplace(pos, std::move(merged));
+        }
+    }
+
+    ByteIO* backend;
+    size_t maxBufferedBytes;
+
+    uint64_t backendSize;
+
+    std::map<uint64_t, std::vector<uint8_t>> dirty;
+    size_t bufferedBytes;
+};
+
+}
+
+#endif
@@ -1,17 +1,23 @@
 #pragma once
 
 #include <bleb/buffer.hpp>
+#include <bleb/span_growth_policy.hpp>
 
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 
+#include <map>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace bleb {
 
 struct SpanHeader_t;
 class ByteIO;
+class FreeSpaceManager;
 class Repository;
 class RepositoryDirectory;
 
@@ -37,7 +43,14 @@ enum ErrorKind {
 
 enum StreamCreationMode {
     kStreamCreate = 1,
-    kStreamTruncate = 2
+    kStreamTruncate = 2,
+    kStreamAppend = 4,          // locate the end of the stream right away, in preparation for appending
+};
+
+// A contiguous range of bytes in the underlying ByteIO
+struct ObjectExtent {
+    uint64_t location;
+    uint64_t length;
 };
 
 struct ErrorStruct_ {
@@ -83,6 +96,11 @@ private:
     char* objectName;
 };
 
+// A Repository can be shared by several threads if its ByteIO supports concurrent access (like PosixFdByteIO).
+// Calls into the Repository, opening and closing streams and updating stream metadata are serialized, while the
+// contents of streams are read and written in parallel. Each stream returned by openStream must only be used by one
+// thread at a time, and an object must not be written while other threads read it. A DirectoryIterator returns names
+// in a buffer shared with the Repository, so it must not be used concurrently with anything else.
 class Repository {
 public:
     Repository(ByteIO* io);
@@ -90,16 +108,87 @@ public:
     bool open(bool canCreateNew);
     void close();
 
+    // Write out all deferred metadata of the Content Directory and flush the ByteIO.
+    // Streams returned by openStream must be flushed separately (or destroyed) first.
+    bool flush();
+
     ErrorKind getErrorKind() const { return error.errorKind; }
     const char* getErrorDesc() const { return error.errorDesc; }
 
-    std::unique_ptr<ByteIO> openStream(const char* objectName, int streamCreationMode);
+    // If `expectedSize` is known and the stream is empty (new or truncated), a single span that big is reserved
+    // right away, so that the data ends up contiguous.
+    // `spanGrowthPolicy` overrides the Repository's policy for this stream; it must outlive the stream
+    std::unique_ptr<ByteIO> openStream(const char* objectName, int streamCreationMode, uint64_t expectedSize = 0,
+            SpanGrowthPolicy* spanGrowthPolicy = nullptr);
 
     // FIXME: return?
     void getObjectContents(const char* objectName, uint8_t*& contents_out, size_t& length_out);
 
+    // Zero-copy variant of getObjectContents; only succeeds if the ByteIO supports viewBytesAt and the object is
+    // stored contiguously (Inline Payload or a single-span stream). The view is invalidated by any modification.
+    bool getObjectView(const char* objectName, const uint8_t*& contents_out, size_t& length_out);
+
+    // Describe where the contents of an object are physically stored, as a list of extents (in order) which add up
+    // to the object's length. This allows transferring the data without copying it through the Repository
+    // (sendfile, copy_file_range, mmap...). The extents are invalidated by any modification of the Repository.
+    bool getObjectExtents(const char* objectName, std::vector<ObjectExtent>& extents_out);
+
+    // Rewrite a stream object that is spread over several spans into a single contiguous span, so that it can be read
+    // in one go. Inline Payloads and single-span streams are left alone. The object must not be open at the time.
+    bool defragmentObject(const char* objectName);
+
+    // When creating a new repository, the beginning of the file is reserved for the Content Directory (and thus also
+    // Inline Payloads), so that opening the repository and looking up its metadata touches as few pages as possible.
+    // This region is 256 bytes by default and grows with the expected size of the repository, up to 64 KiB.
+    // Must be set before open().
+    void setExpectedRepositorySize(uint64_t bytes) { this->expectedRepositorySize = bytes; }
+
+    // Write a compacted copy of the repository into `dest`, which must be empty. Invalidated directory entries and
+    // free space are left out, the Content Directory comes first, followed by the contents of all stream objects in
+    // directory order, each of them in a single span. Inline Payloads stay inline.
+    // Like with any Repository, `dest` gets closed when done.
+    bool compactTo(ByteIO* dest);
+
+    // Make some progress towards a smaller file without going offline: move up to `maxSpans` spans from the end of the
+    // file into free space further towards the beginning, then cut off whatever is free at the end (if the ByteIO
+    // supports truncate). The first step after the repository has been modified has to walk all streams to find out
+    // where their spans are. Fails with errNotAllowed while any streams obtained through openStream are open.
+    // Returns 1 if there might be more to do, -1 once nothing else can be moved, 0 on error.
+    int compactStep(unsigned int maxSpans);
+
     void setAllocationGranularity(SizeType value) { this->allocationGranularity = value; }
 
+    // Decide the length of new spans using `policy` (which must outlive the Repository).
+    // nullptr restores the built-in heuristic, which aligns spans to 1/8 of the stream length or the allocation
+    // granularity, whichever is larger.
+    void setSpanGrowthPolicy(SpanGrowthPolicy* policy) { this->spanGrowthPolicy = policy; }
+
+    // Align the data (not the header) of newly allocated spans, as well as their length, to `value` bytes.
+    // Useful with DirectFdByteIO (use the device block size, typically 4096). Must be a power of 2; default is 1.
+    void setSpanDataAlignment(uint32_t value) { this->spanDataAlignment = value; }
+
+    // Spans of up to 4 KiB (including the header) are rounded up to a power of 2, at least 64 bytes, and carved out of
+    // regions shared by spans of the same size, so that small objects end up packed together instead of scattered
+    // over the file. Not used for spans with data alignment. Off by default.
+    void setSmallSpanPooling(bool enable) { this->smallSpanPooling = enable; }
+
+    // In write-back mode, span headers are only updated in memory as streams are written and persisted together
+    // when the stream is flushed or closed (or once too many of them accumulate). This saves an I/O per write when
+    // doing many small appends, but until then, the on-disk state of the stream is stale. Applies to streams opened
+    // afterwards (including the Content Directory, so set this before open()). Off by default.
+    void setMetadataWriteBack(bool enable) { this->metadataWriteBack = enable; }
+
+    // Total length of the regions of the file which have been released and are available for new spans
+    uint64_t getFreeSpaceLength() const;
+
+    // Streams doing small sequential reads fetch this many bytes at once into a buffer, which often saves a separate
+    // read for the next span header too. 0 disables read-ahead; the default is 64 KiB.
+    void setReadAheadSize(size_t bytes) { this->readAheadSize = bytes; }
+
+    // Streams that have been written to and span more than `maxSpans` spans (of those visited while open) are
+    // defragmented automatically when closed. 0 (the default) disables this.
+    void setDefragmentationThreshold(unsigned int maxSpans) { this->defragmentationThreshold = maxSpans; }
+
     // FIXME: type-safe flags; return?
     void setObjectContents(const char* objectName, const char* contents, int flags);
     void setObjectContents(const char* objectName, const void* contents, size_t length, int flags);
@@ -114,7 +203,24 @@ private:
     Repository(const Repository&) = delete;
 
     // FIXME: use return value tuple rather than _out arguments
-    bool allocateSpan(uint64_t& location_out, SpanHeader_t& header_out, uint64_t streamLengthHint, uint64_t spanLength);
+    // The data of the new span reads as zeroes, except for the first `writtenLength` bytes, which the caller is about to
+    // overwrite anyway.
+    bool allocateSpan(uint64_t& location_out, SpanHeader_t& header_out, uint64_t streamLengthHint, uint64_t spanLength,
+            SpanGrowthPolicy* policy = nullptr, uint64_t writtenLength = 0);
+    void releaseSpan(uint64_t location, uint32_t reservedLength);
+
+    bool allocateSlabSlot(unsigned int sizeClass, uint64_t& location_out, bool& zeroed_out);
+    void releaseSlabRegions();
+
+    uint64_t getHotRegionLength() const;
+
+    bool findLiveSpans();
+    bool addLiveSpans(int referrerKind, uint64_t referrerPos, uint64_t location);
+    bool moveLiveSpan(uint64_t location, uint64_t newLocation);
+    void trimFreeSpace();
+
+    bool loadFreeSpace();
+    void storeFreeSpace();
 
     uint8_t* getEntryBuffer(size_t size);
 
@@ -132,15 +238,68 @@ private:
     // entry buffer
     Buffer<uint8_t> entryBuffer;
 
+    // regions of the file no longer used by any stream; persisted on close if the repository has a Free Space Stream
+    std::unique_ptr<FreeSpaceManager> freeSpace;
+    bool hasFreeSpaceStream = false;
+    bool freeSpaceDirty = false;
+    bool writingFreeSpace = false;
+
+    // small span pooling: unused part of the current region for each size class
+    enum { minSlabSlotLength = 64, maxSlabSlotLength = 4096, numSlabSizeClasses = 7, slotsPerSlabRegion = 16 };
+
+    struct SlabRegion {
+        uint64_t next;
+        uint64_t end;
+        bool zeroed;
+    };
+
+    SlabRegion slabRegions[numSlabSizeClasses];
+
+    // online compaction: all spans in use and whatever points to them, by location; rebuilt after any allocation or
+    // release. Used lengths are not kept, since plain writes change them.
+    enum { kReferrerInFile, kReferrerInDirectory, kReferrerInSpanHeader };
+
+    struct LiveSpan {
+        int referrerKind;
+        uint64_t referrerPos;           // Stream Descriptor (in the file or the Content Directory) or Span Header
+        uint32_t reservedLength;
+        uint64_t nextSpanLocation;
+    };
+
+    std::map<uint64_t, LiveSpan> liveSpans;
+    bool liveSpansValid = false;
+
+    // streams handed out by openStream and not destroyed yet; their spans can't be moved
+    unsigned int numOpenStreams = 0;
+
+    // last span of recently modified streams, by location of their first span; the header is re-read before use
+    struct TailSpan {
+        uint64_t location;
+        uint64_t posInStream;
+        uint32_t reservedLength;
+    };
+
+    std::unordered_map<uint64_t, TailSpan> tailSpans;
+
+    // guards everything above, as well as the Content Directory stream; recursive because streams created by the
+    // Repository take it too when they are destroyed
+    mutable std::recursive_mutex mutex;
+
     ErrorStruct_ error;
 
     // tuning
     SizeType allocationGranularity;
+    SpanGrowthPolicy* spanGrowthPolicy;
+    uint32_t spanDataAlignment;
+    bool metadataWriteBack;
+    bool smallSpanPooling;
+    unsigned int defragmentationThreshold;
+    size_t readAheadSize;
 
-    enum { reserveAlignment = 64 };
+    uint64_t expectedRepositorySize;
 
-    enum { contentDirectoryReserveLength = 192 };
-    enum { contentDirectoryExpectedSize = 192 };
+    // beginning of the file reserved for the Content Directory
+    enum { minHotRegionLength = 256, maxHotRegionLength = 64 * 1024 };
 
     friend class DirectoryIterator;
     friend class RepositoryDirectory;
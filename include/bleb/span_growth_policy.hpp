@@ -0,0 +1,58 @@
+#ifndef bleb_span_growth_policy_hpp
+#define bleb_span_growth_policy_hpp
+
+#include <algorithm>
+#include <cstdint>
+
+namespace bleb {
+
+// Decides how much space to reserve whenever a stream needs a new span.
+// Policies can be set per Repository (Repository::setSpanGrowthPolicy) or per stream (Repository::openStream).
+class SpanGrowthPolicy {
+public:
+    virtual ~SpanGrowthPolicy() {}
+
+    // `streamLength` is the current length of the stream (or its expected length, if known), `requiredLength` the
+    // number of bytes about to be written. Returning less than `requiredLength` is fine; the rest goes into another
+    // span. The Repository will align the result to the span data alignment and cap it at 4 GiB.
+    virtual uint64_t getSpanLength(uint64_t streamLength, uint64_t requiredLength) = 0;
+};
+
+// Every new span makes the stream `factor` times longer (2 doubles it), within [minSpanLength, maxSpanLength].
+// Good for append-heavy objects like logs, which end up with only a logarithmic number of spans.
+class GeometricSpanGrowthPolicy : public SpanGrowthPolicy {
+public:
+    GeometricSpanGrowthPolicy(double factor = 2.0, uint32_t minSpanLength = 256,
+            uint32_t maxSpanLength = 64 * 1024 * 1024, uint32_t alignment = 32)
+            : factor(factor), minSpanLength(minSpanLength), maxSpanLength(maxSpanLength), alignment(alignment) {}
+
+    uint64_t getSpanLength(uint64_t streamLength, uint64_t requiredLength) override {
+        uint64_t length = std::max<uint64_t>(requiredLength, (uint64_t)(streamLength * (factor - 1.0)));
+        length = std::min<uint64_t>(std::max<uint64_t>(length, minSpanLength), maxSpanLength);
+
+        return (length + alignment - 1) / alignment * alignment;
+    }
+
+private:
+    double factor;
+    uint32_t minSpanLength, maxSpanLength;
+    uint32_t alignment;
+};
+
+// Reserve exactly what's being written, rounded up to `alignment`. Best for objects written in one go and never
+// modified afterwards, but disastrous for streams growing in small steps.
+class ExactFitSpanGrowthPolicy : public SpanGrowthPolicy {
+public:
+    ExactFitSpanGrowthPolicy(uint32_t alignment = 1) : alignment(alignment) {}
+
+    uint64_t getSpanLength(uint64_t /*streamLength*/, uint64_t requiredLength) override {
+        return (requiredLength + alignment - 1) / alignment * alignment;
+    }
+
+private:
+    uint32_t alignment;
+};
+
+}
+
+#endif
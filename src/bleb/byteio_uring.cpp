@@ -0,0 +1,382 @@
+#ifdef __linux__
+
+#include <bleb/byteio_uring.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+namespace bleb {
+struct IoUringByteIO::Ring {
+    struct Request {
+        uint8_t opcode;
+        uint64_t pos;
+        uint8_t* buffer;
+        size_t count;
+        std::function<void(bool)> completion;
+    };
+
+    ~Ring() {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqesSize);
+
+        if (cqRing != MAP_FAILED && cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+
+        if (sqRing != MAP_FAILED)
+            munmap(sqRing, sqRingSize);
+
+        if (ringFd >= 0)
+            ::close(ringFd);
+    }
+
+    int ringFd = -1;
+    unsigned int entries = 0;
+
+    void* sqRing = MAP_FAILED;
+    void* cqRing = MAP_FAILED;
+    void* sqes = MAP_FAILED;
+    size_t sqRingSize = 0, cqRingSize = 0, sqesSize = 0;
+
+    unsigned int* sqHead = nullptr;
+    unsigned int* sqTail = nullptr;
+    unsigned int* sqMask = nullptr;
+    unsigned int* sqArray = nullptr;
+
+    unsigned int* cqHead = nullptr;
+    unsigned int* cqTail = nullptr;
+    unsigned int* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    unsigned int queued = 0;        // in the submission ring, but not submitted yet
+    unsigned int inFlight = 0;      // not reaped yet (includes queued)
+    bool failed = false;            // io_uring_enter has failed; only synchronous I/O from now on
+    uint64_t numRequests = 0;
+    uint64_t numSubmissions = 0;
+
+    std::vector<Request> requests;
+    std::vector<unsigned int> freeRequests;
+};
+
+IoUringByteIO::IoUringByteIO(int fd, bool close, unsigned int queueDepth) : PosixFdByteIO(fd, close) {
+    std::unique_ptr<Ring> ring(new Ring);
+
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring->ringFd = (int) syscall(__NR_io_uring_setup, queueDepth, &params);
+
+    if (ring->ringFd < 0)
+        return;
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    const bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+    if (singleMmap)
+        ring->sqRingSize = ring->cqRingSize = std::max(ring->sqRingSize, ring->cqRingSize);
+
+    ring->sqRing = mmap(nullptr, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring->ringFd, IORING_OFF_SQ_RING);
+
+    if (ring->sqRing == MAP_FAILED)
+        return;
+
+    if (singleMmap)
+        ring->cqRing = ring->sqRing;
+    else {
+        ring->cqRing = mmap(nullptr, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring->ringFd, IORING_OFF_CQ_RING);
+
+        if (ring->cqRing == MAP_FAILED)
+            return;
+    }
+
+    ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes = mmap(nullptr, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring->ringFd, IORING_OFF_SQES);
+
+    if (ring->sqes == MAP_FAILED)
+        return;
+
+    uint8_t* sq = reinterpret_cast<uint8_t*>(ring->sqRing);
+    uint8_t* cq = reinterpret_cast<uint8_t*>(ring->cqRing);
+
+    ring->sqHead = reinterpret_cast<unsigned int*>(sq + params.sq_off.head);
+    ring->sqTail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+    ring->sqMask = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+    ring->sqArray = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+
+    ring->cqHead = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+    ring->cqTail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+    ring->cqMask = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+    ring->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // the completion ring is at least as big as the submission ring, so limiting the number of requests in flight
+    // to the number of SQEs guarantees that completions never overflow
+    ring->entries = params.sq_entries;
+    ring->requests.resize(ring->entries);
+
+    for (unsigned int i = ring->entries; i > 0; i--)
+        ring->freeRequests.push_back(i - 1);
+
+    this->ring = std::move(ring);
+}
+
+IoUringByteIO::~IoUringByteIO() {
+    close();
+}
+
+void IoUringByteIO::close() {
+    if (ring) {
+        waitForCompletion();
+        ring.reset();
+    }
+
+    PosixFdByteIO::close();
+}
+
+bool IoUringByteIO::getBytesAtAsync(uint64_t pos, uint8_t* buffer, size_t count,
+        std::function<void(bool)> completion) {
+    // a single SQE can't describe more than 4 GiB
+    if (!ring || count > std::numeric_limits<uint32_t>::max() || !makeRoom())
+        return PosixFdByteIO::getBytesAtAsync(pos, buffer, count, std::move(completion));
+
+    queueRequest(IORING_OP_READ, pos, buffer, count, std::move(completion));
+    return true;
+}
+
+uint64_t IoUringByteIO::getNumRingRequests() const {
+    return ring ? ring->numRequests : 0;
+}
+
+uint64_t IoUringByteIO::getNumSubmissions() const {
+    return ring ? ring->numSubmissions : 0;
+}
+
+bool IoUringByteIO::getBytesAtV(const ReadSegment* segments, size_t count) {
+    // skip PosixFdByteIO's preadv implementation; the generic one batches through getBytesAtAsync
+    return ByteIO::getBytesAtV(segments, count);
+}
+
+bool IoUringByteIO::setBytesAtV(const WriteSegment* segments, size_t count) {
+    if (!ring)
+        return PosixFdByteIO::setBytesAtV(segments, count);
+
+    bool success = true;
+
+    for (size_t i = 0; i < count && success; i++) {
+        if (segments[i].count > std::numeric_limits<uint32_t>::max() || !makeRoom()) {
+            success = setBytesAt(segments[i].pos, segments[i].buffer, segments[i].count);
+            continue;
+        }
+
+        queueRequest(IORING_OP_WRITE, segments[i].pos, const_cast<uint8_t*>(segments[i].buffer),
+                segments[i].count, [&success](bool result) { success = success && result; });
+    }
+
+    // must wait even after a failure, since the completions reference `success`; waitForCompletion reaps every
+    // request, even if the ring fails in the meantime
+    return waitForCompletion() && success;
+}
+
+/*
+ *  Make sure a request can be queued, waiting for some of the outstanding ones if the ring is full.
+ *  Returns false if the ring has failed and the request should be done synchronously instead.
+ */
+bool IoUringByteIO::makeRoom() {
+    while (!ring->failed && ring->inFlight == ring->entries)
+        enter(1);
+
+    return !ring->failed;
+}
+
+void IoUringByteIO::queueRequest(uint8_t opcode, uint64_t pos, uint8_t* buffer, size_t count,
+        std::function<void(bool)> completion) {
+    const unsigned int requestIndex = ring->freeRequests.back();
+    ring->freeRequests.pop_back();
+
+    auto& request = ring->requests[requestIndex];
+    request.opcode = opcode;
+    request.pos = pos;
+    request.buffer = buffer;
+    request.count = count;
+    request.completion = std::move(completion);
+
+    // we are the only producer, so the tail can be read without synchronization
+    const unsigned int tail = *ring->sqTail;
+    const unsigned int index = tail & *ring->sqMask;
+
+    io_uring_sqe* sqe = reinterpret_cast<io_uring_sqe*>(ring->sqes) + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = getFd();
+    sqe->off = pos;
+    sqe->addr = (uint64_t) (uintptr_t) buffer;
+    sqe->len = (uint32_t) count;
+    sqe->user_data = requestIndex;
+
+    ring->sqArray[index] = index;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    ring->queued++;
+    ring->inFlight++;
+    ring->numRequests++;
+}
+
+bool IoUringByteIO::waitForCompletion() {
+    if (!ring)
+        return true;
+
+    bool success = true;
+
+    while (ring->inFlight > 0) {
+        if (!enter(ring->inFlight))
+            success = false;
+    }
+
+    return success;
+}
+
+/*
+ *  Submit all queued requests and wait for at least `minComplete` of the outstanding ones, then reap them.
+ *  If the kernel refuses, the ring is drained (see failRing) and false is returned.
+ */
+bool IoUringByteIO::enter(unsigned int minComplete) {
+    // EAGAIN/EBUSY retries without any completion becoming available
+    unsigned int fruitlessRetries = 0;
+
+    for (;;) {
+        int submitted = (int) syscall(__NR_io_uring_enter, ring->ringFd, ring->queued, minComplete,
+                IORING_ENTER_GETEVENTS, nullptr, 0);
+
+        if (submitted >= 0) {
+            ring->numSubmissions++;
+            ring->queued -= std::min<unsigned int>(ring->queued, submitted);
+            break;
+        }
+        else if (errno == EINTR)
+            continue;
+        else if ((errno == EAGAIN || errno == EBUSY) && fruitlessRetries < kMaxEnterRetries) {
+            // the kernel wants us to consume some completions first, or is short on memory; back off when there
+            // is nothing to consume
+            if (reapCompletions() > 0)
+                fruitlessRetries = 0;
+            else
+                backOff(fruitlessRetries++);
+
+            continue;
+        }
+        else {
+            failRing();
+            return false;
+        }
+    }
+
+    reapCompletions();
+    return true;
+}
+
+/*
+ *  io_uring_enter has failed for good. Requests already taken by the kernel still reference their buffers, so they
+ *  have to be waited for regardless; the ones it hasn't picked up yet are taken back and done synchronously.
+ *  Afterwards, inFlight is 0 and all further requests bypass the ring.
+ */
+void IoUringByteIO::failRing() {
+    ring->failed = true;
+
+    // without SQPOLL, the kernel only consumes submissions inside io_uring_enter, so the head is stable here
+    const unsigned int head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    const unsigned int tail = *ring->sqTail;
+
+    std::vector<unsigned int> unsubmitted;
+
+    for (unsigned int i = head; i != tail; i++) {
+        const unsigned int index = ring->sqArray[i & *ring->sqMask];
+        unsubmitted.push_back((unsigned int) (reinterpret_cast<io_uring_sqe*>(ring->sqes) + index)->user_data);
+    }
+
+    __atomic_store_n(ring->sqTail, head, __ATOMIC_RELEASE);
+    ring->queued = 0;
+
+    std::vector<std::pair<std::function<void(bool)>, bool>> finished;
+
+    for (unsigned int requestIndex : unsubmitted) {
+        auto& request = ring->requests[requestIndex];
+        bool success;
+
+        if (request.opcode == IORING_OP_READ)
+            success = PosixFdByteIO::getBytesAt(request.pos, request.buffer, request.count);
+        else
+            success = PosixFdByteIO::setBytesAt(request.pos, request.buffer, request.count);
+
+        finished.emplace_back(std::move(request.completion), success);
+        ring->freeRequests.push_back(requestIndex);
+        ring->inFlight--;
+    }
+
+    for (auto& completion : finished)
+        completion.first(completion.second);
+
+    // the kernel posts completions on its own, so polling the completion ring is enough
+    for (unsigned int attempt = 0; ring->inFlight > 0; ) {
+        if (reapCompletions() > 0)
+            attempt = 0;
+        else
+            backOff(attempt++);
+    }
+}
+
+void IoUringByteIO::backOff(unsigned int attempt) {
+    // 1 us, doubling up to ~1 ms
+    timespec delay {0, 1000L << std::min(attempt, 10u)};
+    nanosleep(&delay, nullptr);
+}
+
+unsigned int IoUringByteIO::reapCompletions() {
+    const unsigned int start = *ring->cqHead;
+    unsigned int head = start;
+    const unsigned int tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+    // completions are only invoked after the ring has been updated, so that they can safely issue new requests
+    std::vector<std::pair<std::function<void(bool)>, bool>> finished;
+
+    for (; head != tail; head++) {
+        const io_uring_cqe* cqe = &ring->cqes[head & *ring->cqMask];
+        auto& request = ring->requests[(unsigned int) cqe->user_data];
+
+        // the kernel might not support the operation at all, or the transfer might have been short;
+        // in either case, do the rest synchronously
+        const size_t done = (cqe->res > 0) ? (size_t) cqe->res : 0;
+        bool success = (cqe->res >= 0 && done == request.count);
+
+        if (!success && (cqe->res < 0 || done > 0)) {
+            if (request.opcode == IORING_OP_READ)
+                success = PosixFdByteIO::getBytesAt(request.pos + done, request.buffer + done, request.count - done);
+            else
+                success = PosixFdByteIO::setBytesAt(request.pos + done, request.buffer + done, request.count - done);
+        }
+        else if (success && request.opcode == IORING_OP_WRITE)
+            growSize(request.pos + request.count);
+
+        finished.emplace_back(std::move(request.completion), success);
+        ring->freeRequests.push_back((unsigned int) cqe->user_data);
+        ring->inFlight--;
+    }
+
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+
+    for (auto& completion : finished)
+        completion.first(completion.second);
+
+    return head - start;
+}
+}
+
+#endif
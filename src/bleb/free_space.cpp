@@ -0,0 +1,98 @@
+#include "free_space.hpp"
+
+#include <cassert>
+
+namespace bleb {
+void FreeSpaceManager::clear() {
+    byLocation.clear();
+    byLength.clear();
+    totalFree = 0;
+}
+
+void FreeSpaceManager::release(uint64_t location, uint64_t length) {
+    if (length == 0)
+        return;
+
+    // merge with the preceding extent, if adjacent
+    auto next = byLocation.lower_bound(location);
+
+    if (next != byLocation.begin()) {
+        auto prev = std::prev(next);
+        assert(prev->first + prev->second <= location);
+
+        if (prev->first + prev->second == location) {
+            location = prev->first;
+            length += prev->second;
+            erase(prev);
+        }
+    }
+
+    // merge with the following extent, if adjacent
+    if (next != byLocation.end()) {
+        assert(location + length <= next->first);
+
+        if (location + length == next->first) {
+            length += next->second;
+            erase(next);
+        }
+    }
+
+    insert(location, length);
+}
+
+bool FreeSpaceManager::allocate(uint64_t length, uint64_t alignment, uint64_t alignmentOffset,
+        uint64_t& location_out, uint64_t maxEnd) {
+    // smallest extents first
+    for (auto it = byLength.lower_bound(std::make_pair(length, (uint64_t) 0)); it != byLength.end(); ++it) {
+        const uint64_t extentLocation = it->second;
+        const uint64_t extentLength = it->first;
+
+        const uint64_t location = ((extentLocation + alignmentOffset + alignment - 1) & ~(alignment - 1))
+                - alignmentOffset;
+        const uint64_t padding = location - extentLocation;
+
+        if (padding + length > extentLength || location + length > maxEnd)
+            continue;
+
+        erase(byLocation.find(extentLocation));
+
+        // give back what's left on either side
+        if (padding > 0)
+            insert(extentLocation, padding);
+
+        if (padding + length < extentLength)
+            insert(location + length, extentLength - padding - length);
+
+        location_out = location;
+        return true;
+    }
+
+    return false;
+}
+
+bool FreeSpaceManager::takeTrailing(uint64_t fileSize, uint64_t& location_out) {
+    if (byLocation.empty())
+        return false;
+
+    auto last = std::prev(byLocation.end());
+
+    if (last->first + last->second != fileSize)
+        return false;
+
+    location_out = last->first;
+    erase(last);
+    return true;
+}
+
+void FreeSpaceManager::insert(uint64_t location, uint64_t length) {
+    byLocation.emplace(location, length);
+    byLength.emplace(length, location);
+    totalFree += length;
+}
+
+void FreeSpaceManager::erase(std::map<uint64_t, uint64_t>::iterator it) {
+    byLength.erase(std::make_pair(it->second, it->first));
+    totalFree -= it->second;
+    byLocation.erase(it);
+}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <utility>
+
+namespace bleb {
+/*
+ *  Keeps track of unused regions of the repository file, so that they can be reused for new spans.
+ *  Adjacent regions are coalesced; allocation is best-fit.
+ */
+class FreeSpaceManager {
+public:
+    void clear();
+
+    // Mark `length` bytes at `location` as free
+    void release(uint64_t location, uint64_t length);
+
+    // Find a free region of at least `length` bytes such that `location_out + alignmentOffset` is a multiple of
+    // `alignment` (a power of 2), ending no further than `maxEnd`. Anything left over stays free.
+    bool allocate(uint64_t length, uint64_t alignment, uint64_t alignmentOffset, uint64_t& location_out,
+            uint64_t maxEnd = UINT64_MAX);
+
+    // If the last free region ends exactly at `fileSize`, stop tracking it and return its location
+    bool takeTrailing(uint64_t fileSize, uint64_t& location_out);
+
+    uint64_t getTotalFree() const { return totalFree; }
+
+    // location -> length
+    const std::map<uint64_t, uint64_t>& getExtents() const { return byLocation; }
+
+private:
+    void insert(uint64_t location, uint64_t length);
+    void erase(std::map<uint64_t, uint64_t>::iterator it);
+
+    std::map<uint64_t, uint64_t> byLocation;
+    std::set<std::pair<uint64_t, uint64_t>> byLength;      // (length, location)
+
+    uint64_t totalFree = 0;
+};
+}
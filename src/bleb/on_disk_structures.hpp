@@ -12,6 +12,10 @@ struct RepositoryPrologue_t {
     enum { SIZE = 16 };
     enum { kFormatVersion1 = 0x01 };
 
+    enum {
+        kHasFreeSpaceStream = 0x0001,
+    };
+
     uint8_t magic[7];
     uint8_t formatVersion;
     uint32_t flags;
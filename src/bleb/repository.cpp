@@ -1,12 +1,15 @@
 #include <bleb/byteio.hpp>
 #include <bleb/repository.hpp>
 
+#include "free_space.hpp"
 #include "internal.hpp"
 #include "on_disk_structures.hpp"
 #include "repository_directory.hpp"
 #include "repository_stream.hpp"
 
+#include <algorithm>
 #include <limits>
+#include <vector>
 
 namespace bleb {
 template <typename T> static T roundUpBlockLength(T streamLengthHint, T blockLength, T allocationGranularity) {
@@ -37,10 +40,23 @@ template <typename T> static T roundUpBlockLength(T streamLengthHint, T blockLen
     return align(blockLength, streamLengthHint);
 }
 
+// the Free Space Stream Descriptor follows the Content Directory Stream Descriptor
+static const unsigned int freeSpaceDescrLocation = RepositoryPrologue_t::SIZE + StreamDescriptor_t::SIZE;
+
 Repository::Repository(ByteIO* io) {
     this->io = io;
+    this->freeSpace = std::make_unique<FreeSpaceManager>();
 
     this->allocationGranularity = 32;
+    this->spanGrowthPolicy = nullptr;
+    this->spanDataAlignment = 1;
+    this->metadataWriteBack = false;
+    this->smallSpanPooling = false;
+    this->defragmentationThreshold = 0;
+    this->readAheadSize = 64 * 1024;
+    this->expectedRepositorySize = 0;
+
+    memset(slabRegions, 0, sizeof(slabRegions));
 }
 
 Repository::~Repository() {
@@ -48,6 +64,8 @@ Repository::~Repository() {
 }
 
 bool Repository::open(bool canCreateNew) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
     RepositoryPrologue_t prologue;
 
     const unsigned int cdsDescrLocation = RepositoryPrologue_t::SIZE;
@@ -61,24 +79,35 @@ bool Repository::open(bool canCreateNew) {
 
         memcpy(prologue.magic, prologueMagic, sizeof(prologueMagic));
         prologue.formatVersion = 1;
-        prologue.flags = 0;
+        prologue.flags = RepositoryPrologue_t::kHasFreeSpaceStream;
         prologue.infoFlags = 0;
 
+        // The Content Directory gets the rest of the hot region, right after the Content Directory & Free Space
+        // Stream Descriptors, so that the metadata (and objects with Inline Payloads) can be found in one place
+        const uint64_t hotRegionLength = getHotRegionLength();
+        const uint64_t cdsFirstSpanLocation = RepositoryPrologue_t::SIZE + 2 * StreamDescriptor_t::SIZE;
+
+        SpanHeader_t cdsFirstSpan;
+        cdsFirstSpan.reservedLength = (uint32_t)(hotRegionLength - cdsFirstSpanLocation - SpanHeader_t::SIZE);
+        cdsFirstSpan.usedLength = 0;
+        cdsFirstSpan.nextSpanLocation = 0;
+
+        StreamDescriptor_t cdsDescr;
+        cdsDescr.location = cdsFirstSpanLocation;
+        cdsDescr.length = 0;
+
         if (!storeStruct(io, 0, prologue)
-            || !clearBytesAt(io, RepositoryPrologue_t::SIZE, StreamDescriptor_t::SIZE))
+            || !clearBytesAt(io, RepositoryPrologue_t::SIZE, hotRegionLength - RepositoryPrologue_t::SIZE)
+            || !storeStruct(io, cdsDescrLocation, cdsDescr)
+            || !storeStruct(io, cdsFirstSpanLocation, cdsFirstSpan))
             return error.writeError(), false;
 
+        hasFreeSpaceStream = true;
+
         // create Content Directory
         // cds = Content Directory Stream
 
-        auto cds = std::make_unique<RepositoryStream>(this, io, cdsDescrLocation,
-                contentDirectoryReserveLength,
-                contentDirectoryExpectedSize);
-
-        // Stream allocation might have failed
-        if (!cds->hasFirstSpan())
-            return error.writeError(), false;
-
+        auto cds = std::make_unique<RepositoryStream>(this, io, cdsDescrLocation);
         contentDirectory = std::make_unique<RepositoryDirectory>(this, std::move(cds));
     }
     else {
@@ -88,11 +117,17 @@ bool Repository::open(bool canCreateNew) {
         if (memcmp(prologue.magic, prologueMagic, sizeof(prologueMagic)) != 0)
             return error(errNotABlebRepository, "magic value doesn't match"), false;
 
-        if (prologue.formatVersion > 1 || (prologue.flags & ~(0)) != 0)
+        if (prologue.formatVersion > 1 || (prologue.flags & ~RepositoryPrologue_t::kHasFreeSpaceStream) != 0)
             return error(errNotSupported, "repository format version not recognized"), false;
 
         //diagnostic("repo:\tHeader: format version %d", prologue.formatVersion);
 
+        // older repositories only track free space while open
+        hasFreeSpaceStream = (prologue.flags & RepositoryPrologue_t::kHasFreeSpaceStream) != 0;
+
+        if (hasFreeSpaceStream && !loadFreeSpace())
+            return false;
+
         auto cds = std::make_unique<RepositoryStream>(this, io, cdsDescrLocation);
         contentDirectory = std::make_unique<RepositoryDirectory>(this, std::move(cds));
     }
@@ -102,9 +137,21 @@ bool Repository::open(bool canCreateNew) {
 }
 
 void Repository::close() {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
     if (isOpen) {
         //diagnostic("repo:\tClosing Content Directory");
         contentDirectory.reset();
+        releaseSlabRegions();
+
+        if (hasFreeSpaceStream && freeSpaceDirty)
+            storeFreeSpace();
+
+        freeSpace->clear();
+        freeSpaceDirty = false;
+        tailSpans.clear();
+        liveSpans.clear();
+        liveSpansValid = false;
 
         isOpen = false;
     }
@@ -115,11 +162,210 @@ void Repository::close() {
     }
 }
 
+void Repository::releaseSpan(uint64_t location, uint32_t reservedLength) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    diagnostic("releasing %u-byte span @ %u", (unsigned) reservedLength, (unsigned) location);
+
+    liveSpansValid = false;
+
+    // the data is dead now; let the ByteIO deallocate it until the region gets reused
+    io->discardBytesAt(location + SpanHeader_t::SIZE, reservedLength);
+
+    freeSpace->release(location, SpanHeader_t::SIZE + reservedLength);
+    freeSpaceDirty = true;
+
+    // if this was the first span of a stream, the stream is gone
+    tailSpans.erase(location);
+}
+
+// 1/256 of the expected size of the repository, as a power of 2 between 256 bytes and 64 KiB
+uint64_t Repository::getHotRegionLength() const {
+    uint64_t length = minHotRegionLength;
+
+    while (length < maxHotRegionLength && length * 256 < expectedRepositorySize)
+        length *= 2;
+
+    return length;
+}
+
+uint64_t Repository::getFreeSpaceLength() const {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    return freeSpace->getTotalFree();
+}
+
+/*
+ *  Read the persisted list of free regions. The list is cleared on disk right away, so that if the Repository isn't
+ *  closed properly, the regions are merely lost rather than handed out twice.
+ */
+bool Repository::loadFreeSpace() {
+    RepositoryStream stream(this, io, freeSpaceDescrLocation);
+
+    if (!stream.hasFirstSpan())
+        return true;
+
+    uint8_t countBytes[8];
+
+    if (!stream.getBytesAt(0, countBytes, sizeof(countBytes)))
+        return error.readError(), false;
+
+    const uint8_t* p = countBytes;
+    uint64_t count;
+    deserializeLE(count, p);
+
+    if (count == 0)
+        return true;
+
+    if (count > (stream.getSize() - sizeof(countBytes)) / 16)
+        return error.repositoryCorruption("free space list longer than its stream"), false;
+
+    std::vector<uint8_t> extentBytes((size_t) count * 16);
+
+    if (!stream.getBytesAt(sizeof(countBytes), &extentBytes[0], extentBytes.size()))
+        return error.readError(), false;
+
+    // storeFreeSpace writes the extents sorted and coalesced; anything else means the list can't be trusted, and
+    // handing out space which is in use would destroy data. Check everything before releasing anything.
+    std::vector<std::pair<uint64_t, uint64_t>> extents((size_t) count);
+    const uint64_t fileSize = io->getSize();
+    uint64_t previousEnd = freeSpaceDescrLocation + StreamDescriptor_t::SIZE;
+
+    p = &extentBytes[0];
+
+    for (auto& extent : extents) {
+        deserializeLE(extent.first, p);
+        deserializeLE(extent.second, p);
+
+        if (extent.second == 0)
+            return error.repositoryCorruption("empty free space extent"), false;
+
+        if (extent.first < previousEnd)
+            return error.repositoryCorruption("free space extents overlap or are out of order"), false;
+
+        if (extent.second > fileSize || extent.first > fileSize - extent.second)
+            return error.repositoryCorruption("free space extent past the end of file"), false;
+
+        previousEnd = extent.first + extent.second;
+    }
+
+    for (const auto& extent : extents)
+        freeSpace->release(extent.first, extent.second);
+
+    // this fails if the ByteIO is read-only, which is fine, since nothing will be allocated then
+    memset(countBytes, 0, sizeof(countBytes));
+    stream.setBytesAt(0, countBytes, sizeof(countBytes));
+
+    freeSpaceDirty = true;
+    return true;
+}
+
+void Repository::storeFreeSpace() {
+    const auto& extents = freeSpace->getExtents();
+
+    std::vector<uint8_t> bytes(8 + extents.size() * 16);
+    uint8_t* p = &bytes[0];
+    serializeLE<uint64_t>(extents.size(), p);
+
+    for (const auto& extent : extents) {
+        serializeLE<uint64_t>(extent.first, p);
+        serializeLE<uint64_t>(extent.second, p);
+    }
+
+    // The stream itself must not take any of the regions it is describing, so it always grows at the end of file.
+    // It is never shrunk, so writing it doesn't release anything either.
+    writingFreeSpace = true;
+    {
+        RepositoryStream stream(this, io, freeSpaceDescrLocation);
+        stream.setBytesAt(0, &bytes[0], bytes.size());
+    }
+    writingFreeSpace = false;
+}
+
+/*
+ *  Take the next slot of the given size class, starting a new region if the current one is used up.
+ *  `zeroed_out` tells whether the slot is known to be all zeroes already.
+ */
+bool Repository::allocateSlabSlot(unsigned int sizeClass, uint64_t& location_out, bool& zeroed_out) {
+    auto& region = slabRegions[sizeClass];
+    const uint64_t slotLength = (uint64_t) minSlabSlotLength << sizeClass;
+
+    if (region.next == region.end) {
+        const uint64_t regionLength = slotLength * slotsPerSlabRegion;
+        uint64_t location;
+
+        if (freeSpace->allocate(regionLength, 1, 0, location)) {
+            freeSpaceDirty = true;
+            region.zeroed = false;
+        }
+        else {
+            location = io->getSize();
+
+            if (!clearBytesAt(io, location, regionLength))
+                return error.writeError(), false;
+
+            region.zeroed = true;
+        }
+
+        diagnostic("new %u-byte slab region @ %u", (unsigned) regionLength, (unsigned) location);
+        region.next = location;
+        region.end = location + regionLength;
+    }
+
+    location_out = region.next;
+    zeroed_out = region.zeroed;
+    region.next += slotLength;
+    return true;
+}
+
+// Give the unused parts of slab regions back to the free space
+void Repository::releaseSlabRegions() {
+    for (auto& region : slabRegions) {
+        if (region.next != region.end) {
+            freeSpace->release(region.next, region.end - region.next);
+            freeSpaceDirty = true;
+        }
+
+        region.next = 0;
+        region.end = 0;
+    }
+}
+
+bool Repository::flush() {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    if (isOpen)
+        return contentDirectory->flush();
+    else if (io)
+        return io->flush();
+    else
+        return true;
+}
+
 bool Repository::allocateSpan(uint64_t& location_out, SpanHeader_t& header_out, uint64_t streamLengthHint,
-        uint64_t spanLength) {
-    spanLength = roundUpBlockLength(streamLengthHint, spanLength, allocationGranularity);
+        uint64_t spanLength, SpanGrowthPolicy* policy, uint64_t writtenLength) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    liveSpansValid = false;
+
+    if (!policy)
+        policy = spanGrowthPolicy;
+
+    // size classes of small span pooling make the built-in rounding unnecessary
+    uint64_t slotSpanLength;
+
+    if (policy)
+        spanLength = slotSpanLength = std::max<uint64_t>(policy->getSpanLength(streamLengthHint, spanLength), 1);
+    else {
+        slotSpanLength = spanLength;
+        spanLength = roundUpBlockLength(streamLengthHint, spanLength, allocationGranularity);
+    }
+
+    const uint64_t maxSpanLength = std::numeric_limits<uint32_t>::max() & ~(uint64_t)(spanDataAlignment - 1);
+    spanLength = align(std::min(spanLength, maxSpanLength), spanDataAlignment);
 
-    uint64_t pos = align(io->getSize(), /*reserveAlignment*/ 1);
+    // the header goes right before the aligned data
+    uint64_t pos = align(io->getSize() + SpanHeader_t::SIZE, spanDataAlignment) - SpanHeader_t::SIZE;
     diagnostic("allocating %u-byte span @ %u (end at %u)", (unsigned) spanLength, (unsigned) pos,
             (unsigned) (pos + StreamDescriptor_t::SIZE + spanLength));
 
@@ -131,11 +377,66 @@ bool Repository::allocateSpan(uint64_t& location_out, SpanHeader_t& header_out,
     header.usedLength = 0;
     header.nextSpanLocation = 0;
 
-    if (!clearBytesAt(io, io->getSize(), pos - io->getSize())       // alignment
-            || !storeStruct(io, pos, header)                        // header
-            || !clearBytesAt(io, pos + StreamDescriptor_t::SIZE, spanLength))   // data
+    if (smallSpanPooling && spanDataAlignment == 1 && !writingFreeSpace
+            && SpanHeader_t::SIZE + spanLength <= maxSlabSlotLength) {
+        unsigned int sizeClass = 0;
+
+        while (((uint64_t) minSlabSlotLength << sizeClass) < SpanHeader_t::SIZE + slotSpanLength)
+            sizeClass++;
+
+        // the span gets the whole slot
+        header.reservedLength = (minSlabSlotLength << sizeClass) - SpanHeader_t::SIZE;
+
+        uint64_t slotLocation;
+        bool zeroed;
+
+        if (!allocateSlabSlot(sizeClass, slotLocation, zeroed))
+            return false;
+
+        const uint64_t skip = std::min<uint64_t>(writtenLength, header.reservedLength);
+
+        if ((!zeroed && !clearBytesAt(io, slotLocation + SpanHeader_t::SIZE + skip, header.reservedLength - skip))
+                || !storeStruct(io, slotLocation, header))
+            return error.writeError(), false;
+
+        location_out = slotLocation;
+        header_out = header;
+        return true;
+    }
+
+    // reuse a released region of the file if possible
+    uint64_t freeLocation;
+
+    if (!writingFreeSpace && freeSpace->allocate(SpanHeader_t::SIZE + spanLength, spanDataAlignment,
+            SpanHeader_t::SIZE, freeLocation)) {
+        freeSpaceDirty = true;
+
+        // new spans are expected to be all zeroes; this overwrites the old data rather than deallocating it, since
+        // the region is going to be filled soon
+        const uint64_t skip = std::min(writtenLength, spanLength);
+
+        if (!clearBytesAt(io, freeLocation + SpanHeader_t::SIZE + skip, spanLength - skip)
+                || !storeStruct(io, freeLocation, header))
+            return error.writeError(), false;
+
+        location_out = freeLocation;
+        header_out = header;
+        return true;
+    }
+
+    // extend the file in one go (alignment + header + data), so that the ByteIO can do it without writing any zeroes
+    const uint64_t oldSize = io->getSize();
+
+    if (!clearBytesAt(io, oldSize, pos + SpanHeader_t::SIZE + spanLength - oldSize)
+            || !storeStruct(io, pos, header))
         return error.writeError(), false;
 
+    // padding needed for alignment can still be used for something smaller
+    if (pos > oldSize && !writingFreeSpace) {
+        freeSpace->release(oldSize, pos - oldSize);
+        freeSpaceDirty = true;
+    }
+
     location_out = pos;
     header_out = header;
     return true;
@@ -148,11 +449,275 @@ uint8_t* Repository::getEntryBuffer(size_t size) {
 }
 
 void Repository::getObjectContents(const char* objectName, uint8_t*& contents_out, size_t& length_out) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
     contentDirectory->getObjectContents(objectName, contents_out, length_out);
 }
 
-std::unique_ptr<ByteIO> Repository::openStream(const char* objectName, int streamCreationMode) {
-    return contentDirectory->openStream(objectName, streamCreationMode, 0);
+bool Repository::compactTo(ByteIO* dest) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    if (!isOpen)
+        return error(errNotAllowed, "repository not open"), false;
+
+    if (dest->getSize() != 0)
+        return error(errNotAllowed, "destination is not empty"), false;
+
+    Repository compacted(dest);
+    compacted.setExpectedRepositorySize(io->getSize() - freeSpace->getTotalFree());
+    compacted.setSpanDataAlignment(spanDataAlignment);
+
+    if (!compacted.open(true) || !contentDirectory->copyObjectsTo(compacted.contentDirectory.get())) {
+        // the problem might be on either side
+        if (compacted.getErrorKind() != errNoError)
+            error(compacted.getErrorKind(), compacted.getErrorDesc());
+
+        return false;
+    }
+
+    compacted.close();
+    return true;
+}
+
+int Repository::compactStep(unsigned int maxSpans) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    if (!isOpen)
+        return error(errNotAllowed, "repository not open"), 0;
+
+    if (numOpenStreams != 0)
+        return error(errNotAllowed, "streams are open"), 0;
+
+    const unsigned int cdsDescrLocation = RepositoryPrologue_t::SIZE;
+
+    // The Content Directory remembers where its spans are, so it has to be reopened afterwards.
+    // Closing it also writes back anything that has been deferred.
+    contentDirectory.reset();
+    contentDirectory = std::make_unique<RepositoryDirectory>(this,
+            std::make_unique<RepositoryStream>(this, io, cdsDescrLocation));
+
+    releaseSlabRegions();
+
+    if (!liveSpansValid && !findLiveSpans())
+        return 0;
+
+    trimFreeSpace();
+
+    unsigned int moved = 0;
+    int result = 1;
+
+    while (moved < maxSpans) {
+        if (liveSpans.empty()) {
+            result = -1;
+            break;
+        }
+
+        // try to find a place for the last span further towards the beginning
+        const auto last = std::prev(liveSpans.end());
+        uint64_t newLocation;
+
+        if (!freeSpace->allocate(SpanHeader_t::SIZE + last->second.reservedLength, spanDataAlignment,
+                SpanHeader_t::SIZE, newLocation, last->first)) {
+            result = -1;
+            break;
+        }
+
+        if (!moveLiveSpan(last->first, newLocation)) {
+            result = 0;
+            break;
+        }
+
+        trimFreeSpace();
+        moved++;
+    }
+
+    contentDirectory.reset();
+    contentDirectory = std::make_unique<RepositoryDirectory>(this,
+            std::make_unique<RepositoryStream>(this, io, cdsDescrLocation));
+    tailSpans.clear();
+
+    return result;
+}
+
+/*
+ *  Walk all streams (Content Directory, Free Space Stream and stream objects) and note down their spans.
+ */
+bool Repository::findLiveSpans() {
+    const unsigned int cdsDescrLocation = RepositoryPrologue_t::SIZE;
+
+    liveSpans.clear();
+
+    for (uint64_t descrLocation : {(uint64_t) cdsDescrLocation, (uint64_t) freeSpaceDescrLocation}) {
+        if (descrLocation == freeSpaceDescrLocation && !hasFreeSpaceStream)
+            continue;
+
+        StreamDescriptor_t descr;
+
+        if (!retrieveStruct(io, descrLocation, descr))
+            return error.readError(), false;
+
+        if (!addLiveSpans(kReferrerInFile, descrLocation, descr.location))
+            return false;
+    }
+
+    std::vector<std::pair<uint64_t, uint64_t>> streamLocations;
+
+    if (!contentDirectory->getStreamLocations(streamLocations))
+        return false;
+
+    for (const auto& stream : streamLocations) {
+        if (!addLiveSpans(kReferrerInDirectory, stream.first, stream.second))
+            return false;
+    }
+
+    liveSpansValid = true;
+    return true;
+}
+
+bool Repository::addLiveSpans(int referrerKind, uint64_t referrerPos, uint64_t location) {
+    while (location != 0) {
+        SpanHeader_t header;
+
+        if (!retrieveStruct(io, location, header))
+            return error.readError(), false;
+
+        if (!liveSpans.emplace(location, LiveSpan {referrerKind, referrerPos, header.reservedLength,
+                header.nextSpanLocation}).second)
+            return error.repositoryCorruption("span belongs to more than one stream"), false;
+
+        referrerKind = kReferrerInSpanHeader;
+        referrerPos = location;
+        location = header.nextSpanLocation;
+    }
+
+    return true;
+}
+
+/*
+ *  Copy a span to a new location (which must have been allocated already), point its referrer to it and release the
+ *  original location.
+ */
+bool Repository::moveLiveSpan(uint64_t location, uint64_t newLocation) {
+    const LiveSpan span = liveSpans[location];
+
+    diagnostic("moving %u-byte span @ %u to %u", (unsigned) span.reservedLength, (unsigned) location,
+            (unsigned) newLocation);
+
+    // Streams can be written to without allocating anything, so the used length must come from the header itself.
+    // The reserved length and the next span only change along with an allocation or a release.
+    SpanHeader_t header;
+
+    if (!retrieveStruct(io, location, header))
+        return error.readError(), false;
+
+    if (header.reservedLength != span.reservedLength || header.nextSpanLocation != span.nextSpanLocation)
+        return error(errInternal, "span changed since the last compaction step"), false;
+
+    // header and data; the rest of the span is expected to be all zeroes
+    const uint64_t usedLength = std::min(header.usedLength, header.reservedLength);
+    const uint64_t copyLength = SpanHeader_t::SIZE + usedLength;
+
+    std::vector<uint8_t> buffer((size_t) std::min<uint64_t>(copyLength, 1024 * 1024));
+
+    for (uint64_t done = 0; done < copyLength; ) {
+        const size_t count = (size_t) std::min<uint64_t>(copyLength - done, buffer.size());
+
+        if (!getBytesAt(io, location + done, &buffer[0], count))
+            return error.readError(), false;
+
+        if (!setBytesAt(io, newLocation + done, &buffer[0], count))
+            return error.writeError(), false;
+
+        done += count;
+    }
+
+    if (!clearBytesAt(io, newLocation + copyLength, span.reservedLength - usedLength))
+        return error.writeError(), false;
+
+    // point the Stream Descriptor or the previous span to the new location
+    uint8_t locationBytes[8];
+    uint8_t* p = locationBytes;
+    serializeLE(newLocation, p);
+
+    if (span.referrerKind == kReferrerInFile) {
+        if (!setBytesAt(io, span.referrerPos, locationBytes, sizeof(locationBytes)))
+            return error.writeError(), false;
+    }
+    else if (span.referrerKind == kReferrerInSpanHeader) {
+        // nextSpanLocation
+        if (!setBytesAt(io, span.referrerPos + 8, locationBytes, sizeof(locationBytes)))
+            return error.writeError(), false;
+
+        liveSpans[span.referrerPos].nextSpanLocation = newLocation;
+    }
+    else {
+        // the descriptor might straddle two spans of the directory, which might also have moved already
+        RepositoryStream directoryStream(this, io, RepositoryPrologue_t::SIZE);
+        std::vector<ObjectExtent> extents;
+
+        if (!directoryStream.getExtents(span.referrerPos, sizeof(locationBytes), extents))
+            return error(directoryStream.getErrorKind(), directoryStream.getErrorDesc()), false;
+
+        size_t done = 0;
+
+        for (const auto& extent : extents) {
+            if (!setBytesAt(io, extent.location, locationBytes + done, (size_t) extent.length))
+                return error.writeError(), false;
+
+            done += (size_t) extent.length;
+        }
+    }
+
+    if (span.nextSpanLocation != 0)
+        liveSpans[span.nextSpanLocation].referrerPos = newLocation;
+
+    liveSpans.erase(location);
+    liveSpans.emplace(newLocation, span);
+
+    io->discardBytesAt(location + SpanHeader_t::SIZE, span.reservedLength);
+    freeSpace->release(location, SpanHeader_t::SIZE + span.reservedLength);
+    freeSpaceDirty = true;
+    return true;
+}
+
+// Cut off free space at the end of the file
+void Repository::trimFreeSpace() {
+    const uint64_t size = io->getSize();
+    uint64_t location;
+
+    if (freeSpace->takeTrailing(size, location)) {
+        freeSpaceDirty = true;
+
+        if (!io->truncate(location))
+            freeSpace->release(location, size - location);
+    }
+}
+
+bool Repository::defragmentObject(const char* objectName) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    return contentDirectory->defragmentObject(objectName);
+}
+
+bool Repository::getObjectExtents(const char* objectName, std::vector<ObjectExtent>& extents_out) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    extents_out.clear();
+
+    return contentDirectory->getObjectExtents(objectName, extents_out);
+}
+
+bool Repository::getObjectView(const char* objectName, const uint8_t*& contents_out, size_t& length_out) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    return contentDirectory->getObjectView(objectName, contents_out, length_out);
+}
+
+std::unique_ptr<ByteIO> Repository::openStream(const char* objectName, int streamCreationMode, uint64_t expectedSize,
+        SpanGrowthPolicy* spanGrowthPolicy) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    return contentDirectory->openStream(objectName, streamCreationMode, expectedSize, spanGrowthPolicy);
 }
 
 void Repository::setObjectContents(const char* objectName, const char* contents, int flags) {
@@ -160,6 +725,8 @@ void Repository::setObjectContents(const char* objectName, const char* contents,
 }
 
 void Repository::setObjectContents(const char* objectName, const void* contents, size_t length, int flags) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
     contentDirectory->setObjectContents(objectName, (const uint8_t*) contents, length,
             flags, ObjectEntryPrologueHeader_t::kIsText);
 }
@@ -21,6 +21,8 @@ DirectoryIterator::DirectoryIterator(Repository* repo, RepositoryDirectory* dir,
 }
 
 bool DirectoryIterator::readNext() {
+    std::lock_guard<std::recursive_mutex> lock(repo->mutex);
+
     RepositoryStream* directoryStream = dir->directoryStream.get();
 
     directoryStream->setPos(pos);
@@ -67,6 +69,10 @@ RepositoryDirectory::RepositoryDirectory(Repository* repo, std::unique_ptr<Repos
         : repo(repo), directoryStream(std::move(directoryStream)) {
 }
 
+bool RepositoryDirectory::flush() {
+    return directoryStream->flush();
+}
+
 /*
  *  Walk the directory and look for an object named `objectName`.
  *  If found, `pos_out` is set to its position within directory and `prologueHeader_out` will contain a copy of the
@@ -152,6 +158,155 @@ int RepositoryDirectory::findObjectByName(const char* objectName, size_t objectN
     return -1;
 }
 
+/*
+ *  Append all valid entries to `dest` (which should be empty), then copy the contents of stream objects, each into a
+ *  single span. Doing it in two passes keeps all of the new directory in front of the object data.
+ */
+bool RepositoryDirectory::copyObjectsTo(RepositoryDirectory* dest) {
+    auto stream = directoryStream.get();
+    auto destStream = dest->directoryStream.get();
+
+    // (source, destination) locations of Stream Descriptors
+    std::vector<std::pair<uint64_t, uint64_t>> streamDescrs;
+    std::vector<uint8_t> entryBytes;
+
+    uint64_t pos = 0;
+
+    while (pos < stream->getSize()) {
+        ObjectEntryPrologueHeader_t prologueHeader;
+
+        if (!retrieveStruct(stream, pos, prologueHeader))
+            return repo->error.readError(), false;
+
+        const uint16_t entryLength = prologueHeader.length & ObjectEntryPrologueHeader_t::kLengthMask;
+        const uint16_t paddedEntryLength = align(entryLength, 16);
+
+        if (!(prologueHeader.length & ObjectEntryPrologueHeader_t::kIsInvalidated)) {
+            if (entryLength < 6)
+                return repo->error.repositoryCorruption("entry with invalid length (length < 6)"), false;
+
+            entryBytes.resize(entryLength);
+
+            if (!getBytesAt(stream, pos, &entryBytes[0], entryLength))
+                return repo->error.readError(), false;
+
+            const uint64_t destPos = destStream->getSize();
+
+            if (prologueHeader.flags & ObjectEntryPrologueHeader_t::kHasStreamDescr) {
+                // FIXME: offset might be incorrect due to other descriptors
+                const size_t offset = ObjectEntryPrologueHeader_t::SIZE + prologueHeader.nameLength;
+
+                if (offset + StreamDescriptor_t::SIZE > entryLength)
+                    return repo->error.repositoryCorruption("entry too short for a stream descriptor"), false;
+
+                // the stream is allocated later
+                StreamDescriptor_t streamDescr;
+                streamDescr.location = 0;
+                streamDescr.length = 0;
+                storeStruct(&entryBytes[0], offset, streamDescr);
+
+                streamDescrs.emplace_back(pos + offset, destPos + offset);
+            }
+
+            if (!dest->overwriteObjectEntryAt(destPos, &entryBytes[0], entryLength))
+                return false;
+        }
+
+        pos += paddedEntryLength;
+    }
+
+    std::vector<uint8_t> buffer;
+
+    for (const auto& descrs : streamDescrs) {
+        RepositoryStream objectStream(repo, stream, descrs.first);
+        RepositoryStream destObjectStream(dest->repo, destStream, descrs.second);
+
+        const uint64_t length = objectStream.getSize();
+
+        if (!destObjectStream.reserve(length))
+            return dest->repo->error(destObjectStream.getErrorKind(), destObjectStream.getErrorDesc()), false;
+
+        buffer.resize((size_t) std::min<uint64_t>(length, 1024 * 1024));
+
+        for (uint64_t done = 0; done < length; ) {
+            const size_t count = (size_t) std::min<uint64_t>(length - done, buffer.size());
+
+            if (objectStream.read(&buffer[0], count) != count)
+                return repo->error(objectStream.getErrorKind(), objectStream.getErrorDesc()), false;
+
+            if (destObjectStream.write(&buffer[0], count) != count)
+                return dest->repo->error(destObjectStream.getErrorKind(), destObjectStream.getErrorDesc()), false;
+
+            done += count;
+        }
+    }
+
+    return true;
+}
+
+bool RepositoryDirectory::getStreamLocations(std::vector<std::pair<uint64_t, uint64_t>>& locations_out) {
+    auto stream = directoryStream.get();
+
+    uint64_t pos = 0;
+
+    while (pos < stream->getSize()) {
+        ObjectEntryPrologueHeader_t prologueHeader;
+
+        if (!retrieveStruct(stream, pos, prologueHeader))
+            return repo->error.readError(), false;
+
+        const uint16_t paddedEntryLength = align(prologueHeader.length & ObjectEntryPrologueHeader_t::kLengthMask, 16);
+
+        if (!(prologueHeader.length & ObjectEntryPrologueHeader_t::kIsInvalidated)
+                && (prologueHeader.flags & ObjectEntryPrologueHeader_t::kHasStreamDescr)) {
+            // FIXME: offset might be incorrect due to other descriptors
+            const size_t offset = ObjectEntryPrologueHeader_t::SIZE + prologueHeader.nameLength;
+
+            StreamDescriptor_t streamDescr;
+
+            if (!retrieveStruct(stream, pos + offset, streamDescr))
+                return repo->error.readError(), false;
+
+            locations_out.emplace_back(pos + offset, streamDescr.location);
+        }
+
+        pos += paddedEntryLength;
+    }
+
+    return true;
+}
+
+/*
+ *  Move a stream object into a single span. Objects with an Inline Payload are left alone.
+ */
+bool RepositoryDirectory::defragmentObject(const char* objectName) {
+    auto stream = directoryStream.get();
+
+    const size_t objectNameLength = strlen(objectName);
+
+    uint64_t pos;
+    ObjectEntryPrologueHeader_t prologueHeader;
+
+    int find = findObjectByName(objectName, objectNameLength, &pos, &prologueHeader);
+
+    if (!find)
+        return false;
+    else if (find < 0)
+        return repo->error(errNotAllowed, "the requested object doesn't exist"), false;
+
+    size_t offset = ObjectEntryPrologueHeader_t::SIZE + prologueHeader.nameLength;
+
+    if (prologueHeader.flags & ObjectEntryPrologueHeader_t::kHasStreamDescr) {
+        // FIXME: offset might be incorrect due to other descriptors
+        RepositoryStream objectStream(repo, stream, pos + offset);
+
+        if (!objectStream.defragment())
+            return repo->error(objectStream.getErrorKind(), objectStream.getErrorDesc()), false;
+    }
+
+    return true;
+}
+
 /*
  *  Retrieve object contents into a malloc-ed buffer.
  */
@@ -209,17 +364,118 @@ bool RepositoryDirectory::getObjectContents(const char* objectName, uint8_t*& co
     }
 }
 
+/*
+ *  Append the physical location of object contents to `extents_out`.
+ *  An Inline Payload is mapped through the extents of the directory stream.
+ */
+bool RepositoryDirectory::getObjectExtents(const char* objectName, std::vector<ObjectExtent>& extents_out) {
+    auto stream = directoryStream.get();
+
+    const size_t objectNameLength = strlen(objectName);
+
+    uint64_t pos;
+    ObjectEntryPrologueHeader_t prologueHeader;
+
+    int find = findObjectByName(objectName, objectNameLength, &pos, &prologueHeader);
+
+    if (!find || find < 0)
+        return false;
+
+    size_t offset = ObjectEntryPrologueHeader_t::SIZE + prologueHeader.nameLength;
+
+    if (prologueHeader.flags & ObjectEntryPrologueHeader_t::kHasStreamDescr) {
+        // FIXME: offset might be incorrect due to other descriptors
+        RepositoryStream objectStream(repo, stream, pos + offset);
+
+        if (!objectStream.getExtents(0, objectStream.getSize(), extents_out))
+            return repo->error.readError(), false;
+
+        return true;
+    }
+    else if (prologueHeader.flags & ObjectEntryPrologueHeader_t::kHasInlinePayload) {
+        // FIXME: offset might be incorrect due to other descriptors
+        if (!stream->getExtents(pos + offset, prologueHeader.length - offset, extents_out))
+            return repo->error.readError(), false;
+
+        return true;
+    }
+    else {
+        assert(false);
+        return repo->error.repositoryCorruption("object doesn't have any kind of payload"), false;
+    }
+}
+
+/*
+ *  Retrieve a pointer to object contents directly in the underlying storage (without copying).
+ *  This is only possible for Inline Payloads and single-span streams on a ByteIO supporting viewBytesAt.
+ *  An empty object yields a nullptr with length 0.
+ */
+bool RepositoryDirectory::getObjectView(const char* objectName, const uint8_t*& contents_out, size_t& length_out) {
+    auto stream = directoryStream.get();
+
+    const size_t objectNameLength = strlen(objectName);
+
+    uint64_t pos;
+    ObjectEntryPrologueHeader_t prologueHeader;
+    size_t length;
+
+    contents_out = nullptr;
+    length_out = 0;
+
+    // look for the object
+    int find = findObjectByName(objectName, objectNameLength, &pos, &prologueHeader);
+
+    if (!find || find < 0)
+        return false;
+
+    size_t offset = ObjectEntryPrologueHeader_t::SIZE + prologueHeader.nameLength;
+
+    if (prologueHeader.flags & ObjectEntryPrologueHeader_t::kHasStreamDescr) {
+        // FIXME: offset might be incorrect due to other descriptors
+        RepositoryStream objectStream(repo, stream, pos + offset);
+
+        if (objectStream.getSize() > std::numeric_limits<size_t>::max())
+            return repo->error(errNotEnoughMemory, "the requested object is too big to fit into memory"), false;
+
+        length = (size_t) objectStream.getSize();
+
+        if (length == 0)
+            return true;
+
+        contents_out = objectStream.viewBytesAt(0, length);
+    }
+    else if (prologueHeader.flags & ObjectEntryPrologueHeader_t::kHasInlinePayload) {
+        // FIXME: offset might be incorrect due to other descriptors
+        length = prologueHeader.length - offset;
+
+        if (length == 0)
+            return true;
+
+        contents_out = stream->viewBytesAt(pos + offset, length);
+    }
+    else {
+        assert(false);
+        return repo->error.repositoryCorruption("object doesn't have any kind of payload"), false;
+    }
+
+    if (contents_out == nullptr)
+        return false;
+
+    length_out = length;
+    return true;
+}
+
 /*
  *  Walk the directory and look for an object named `objectName`.
  *  If found, open it as an I/O stream.
  *  If not found and `streamCreationMode` includes `kStreamCreate`, a new object will be created.
  *  If `streamCreationMode` includes `kStreamTruncate`, the returned stream (if any) will have a length of 0.
- *  `reserveLength` is a hint used to determine the initial allocation size when creating a new object.
+ *  `expectedSize`, if non-zero, is used to reserve a single span of that size if the stream is empty.
  *
  *  If the object was not found nor created OR an error occured, nullptr is returned.
  */
 std::unique_ptr<ByteIO> RepositoryDirectory::openStream(const char* objectName, int streamCreationMode,
-        uint32_t reserveLength) {
+        uint64_t expectedSize, SpanGrowthPolicy* spanGrowthPolicy) {
     auto stream = directoryStream.get();
 
     // first of all, calculate the entry size in case we need to create a new one
@@ -254,13 +510,19 @@ std::unique_ptr<ByteIO> RepositoryDirectory::openStream(const char* objectName,
 
         if (prologueHeader.flags & ObjectEntryPrologueHeader_t::kHasStreamDescr) {
             // object already has a stream, we'll reuse it
-            // TODO: if the stream reserved size is laughably small, we should drop it and start anew
 
             // FIXME: offset might be incorrect due to other descriptors
             std::unique_ptr<RepositoryStream> objectStream(new RepositoryStream(repo, stream, pos + offset));
+            objectStream->setSpanGrowthPolicy(spanGrowthPolicy);
+            objectStream->setOpenedByUser();
 
             if (streamCreationMode & kStreamTruncate)
                 objectStream->setLength(0);
+            else if ((streamCreationMode & kStreamAppend) && !objectStream->seekToEnd())
+                return repo->error(objectStream->getErrorKind(), objectStream->getErrorDesc()), nullptr;
+
+            if (expectedSize != 0 && !objectStream->reserve(expectedSize))
+                return repo->error(objectStream->getErrorKind(), objectStream->getErrorDesc()), nullptr;
 
             return std::move(objectStream);
         }
@@ -330,7 +592,12 @@ std::unique_ptr<ByteIO> RepositoryDirectory::openStream(const char* objectName,
 
     // allocate stream
     std::unique_ptr<RepositoryStream> objectStream(new RepositoryStream(
-            repo, stream, objectEntryPos + streamDescrOffset, reserveLength, reserveLength));
+            repo, stream, objectEntryPos + streamDescrOffset, 0, 0));
+    objectStream->setSpanGrowthPolicy(spanGrowthPolicy);
+    objectStream->setOpenedByUser();
+
+    if (!objectStream->reserve(expectedSize))
+        return repo->error(objectStream->getErrorKind(), objectStream->getErrorDesc()), nullptr;
 
     if (contents.size()) {
         // if there was an inline payload (and we're not truncating), write it into the stream now
@@ -463,7 +730,6 @@ bool RepositoryDirectory::setObjectContents(const char* objectName, const uint8_
 
         if (prologueHeader.flags & ObjectEntryPrologueHeader_t::kHasStreamDescr) {
             // object already has a stream, we'll reuse it
-            // TODO: if the stream reserved size is laughably small, we should drop it and start anew
 
             size_t offset = ObjectEntryPrologueHeader_t::SIZE + prologueHeader.nameLength;
 
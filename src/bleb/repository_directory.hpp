@@ -12,11 +12,21 @@ class RepositoryDirectory {
 public:
     RepositoryDirectory(Repository* repo, std::unique_ptr<RepositoryStream> directoryStream);
 
+    bool copyObjectsTo(RepositoryDirectory* dest);
+    bool defragmentObject(const char* objectName);
     bool getObjectContents(const char* objectName, uint8_t*& contents_out, size_t& length_out);
+    bool getObjectExtents(const char* objectName, std::vector<ObjectExtent>& extents_out);
+    bool getObjectView(const char* objectName, const uint8_t*& contents_out, size_t& length_out);
+
+    // (position of the Stream Descriptor within the directory, location of the first span) of all stream objects
+    bool getStreamLocations(std::vector<std::pair<uint64_t, uint64_t>>& locations_out);
     bool setObjectContents(const char* objectName, const uint8_t* contents, size_t contentsLength,
             unsigned int flags, unsigned int objectFlags);
 
-    std::unique_ptr<ByteIO> openStream(const char* objectName, int streamCreationMode, uint32_t reserveLength);
+    std::unique_ptr<ByteIO> openStream(const char* objectName, int streamCreationMode, uint64_t expectedSize,
+            SpanGrowthPolicy* spanGrowthPolicy);
+
+    bool flush();
 
 private:
     RepositoryDirectory(const RepositoryDirectory&) = delete;
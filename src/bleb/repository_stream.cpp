@@ -3,24 +3,36 @@
 #include "repository_stream.hpp"
 
 #include <algorithm>
+#include <limits>
 
 namespace bleb {
     RepositoryStream::RepositoryStream(Repository* repo, ByteIO* streamDescrIO, uint64_t streamDescrPos) {
         this->repo = repo;
         this->io = repo->io;
         this->isReadOnly = false;
+        this->isOpenedByUser = false;
+        this->writeBack = repo->metadataWriteBack;
+        this->modified = false;
         this->descrIO = streamDescrIO;
         this->descrPos = streamDescrPos;
 
         descrDirty = false;
         pos = 0;
         haveCurrentSpan = false;
+        numDirtySpanHeaders = 0;
+
+        readingAhead = false;
+        readAheadLocation = 0;
+        readAheadLength = 0;
+        lastReadEnd = std::numeric_limits<uint64_t>::max();
 
         initialLengthHint = 0;
+        spanGrowthPolicy = nullptr;
 
         retrieveStruct(descrIO, descrPos, descr);
 
         if (descr.location != 0) {
+            SpanHeader_t firstSpan;
             retrieveStruct(io, descr.location, firstSpan);
             setCurrentSpan(firstSpan, descr.location, 0);
         }
@@ -31,17 +43,28 @@ namespace bleb {
         this->repo = repo;
         this->io = repo->io;
         this->isReadOnly = false;
+        this->isOpenedByUser = false;
+        this->writeBack = repo->metadataWriteBack;
+        this->modified = false;
         this->descrIO = streamDescrIO;
         this->descrPos = streamDescrPos;
 
         descrDirty = false;
         pos = 0;
         haveCurrentSpan = false;
+        numDirtySpanHeaders = 0;
+
+        readingAhead = false;
+        readAheadLocation = 0;
+        readAheadLength = 0;
+        lastReadEnd = std::numeric_limits<uint64_t>::max();
 
         initialLengthHint = 0;
+        spanGrowthPolicy = nullptr;
 
         // create a new stream
         uint64_t firstSpanLocation = 0;
+        SpanHeader_t firstSpan;
 
         if (reserveLength > 0) {
             // This can fail. How to report?
@@ -58,24 +81,81 @@ namespace bleb {
     }
 
     RepositoryStream::~RepositoryStream() {
-        if (descrDirty)
-            storeStruct(descrIO, descrPos, descr);
+        std::lock_guard<std::recursive_mutex> lock(repo->mutex);
+
+        // all spans have been seen already if the stream was written sequentially, so this is a cheap check.
+        // Not for the Free Space stream, whose contents would no longer list the spans released by defragmenting it.
+        if (modified && repo->defragmentationThreshold != 0 && spanIndex.size() > repo->defragmentationThreshold
+                && !repo->writingFreeSpace)
+            defragment();
+
+        writeBackMetadata();
+
+        // let the next stream opened on this object find the end quickly. Only a stream which has changed the object
+        // knows its current end; a reader's view might have been made stale by someone truncating the stream since.
+        if (modified && descr.location != 0 && !spanIndex.empty() && spanIndex.back().header.nextSpanLocation == 0) {
+            const auto& last = spanIndex.back();
+
+            repo->tailSpans[descr.location] = Repository::TailSpan {last.location, last.posInStream,
+                    last.header.reservedLength};
+        }
+
+        if (isOpenedByUser)
+            repo->numOpenStreams--;
     }
 
-    bool RepositoryStream::clearBytesAt(uint64_t pos, uint64_t count) {
-        setPos(pos);
+    void RepositoryStream::setOpenedByUser() {
+        std::lock_guard<std::recursive_mutex> lock(repo->mutex);
 
-        while (count--)
-            if (!write("\x00", 1))
-                return false;
+        if (!isOpenedByUser) {
+            isOpenedByUser = true;
+            repo->numOpenStreams++;
+        }
+    }
+
+    bool RepositoryStream::reserve(uint64_t length) {
+        if (isReadOnly)
+            return false;
+
+        if (length == 0 || descr.length != 0)
+            return true;
+
+        if (descr.location != 0 && !spanIndex.empty() && spanIndex[0].header.reservedLength >= length)
+            return true;
+
+        uint64_t newSpanLocation;
+        SpanHeader_t newSpan;
+
+        // the caller knows best how big the stream is going to be
+        ExactFitSpanGrowthPolicy exactFit;
+
+        if (!repo->allocateSpan(newSpanLocation, newSpan, length, length, &exactFit))
+            return error.writeError(), false;
+
+        if (descr.location != 0 && !releaseSpansFrom(0, descr.location))
+            return false;
+
+        descr.location = newSpanLocation;
+        descrDirty = true;
 
+        setCurrentSpan(newSpan, newSpanLocation, 0);
+        pos = 0;
         return true;
     }
 
-    bool RepositoryStream::gotoRightSpan() {
-        // FIXME: this is highly unoptimal right now (and possibly broken)
-        // we're always starting from the block beginning and going span-by-span
+    bool RepositoryStream::seekToEnd() {
+        setPos(descr.length);
+
+        return descr.location == 0 || haveCurrentSpan || gotoRightSpan();
+    }
 
+    bool RepositoryStream::clearBytesAt(uint64_t pos, uint64_t count) {
+        setPos(pos);
+
+        return writeOrClear(nullptr, count) == count;
+    }
+
+    bool RepositoryStream::gotoRightSpan() {
         if (descr.location == 0) {      // the stream doesn't even exist
             diagnostic("warning: trying to from read an unallocated stream");
             return false;
@@ -84,35 +164,124 @@ namespace bleb {
         if (pos > descr.length)
             return false;
 
-        setCurrentSpan(firstSpan, descr.location, 0);
+        // start from the last known span that begins at or before 'pos'
+        auto it = std::upper_bound(spanIndex.begin(), spanIndex.end(), pos,
+                [](uint64_t pos, const SpanIndexEntry& entry) { return pos < entry.posInStream; });
+        assert(it != spanIndex.begin());
+        --it;
+
+        // if the Repository remembers where the stream ends and that's closer, jump right there (this makes appending
+        // to a long stream cheap)
+        std::unique_lock<std::recursive_mutex> lock(repo->mutex);
+        auto tail = repo->tailSpans.find(descr.location);
+
+        SpanHeader_t tailSpan;
+
+        if (tail != repo->tailSpans.end()
+                && tail->second.posInStream > it->posInStream
+                && tail->second.posInStream <= pos
+                && tail->second.posInStream + tail->second.reservedLength >= descr.length) {
+            // don't write into a span which doesn't end the stream anymore
+            if (retrieveStruct(io, tail->second.location, tailSpan)
+                    && tailSpan.reservedLength == tail->second.reservedLength
+                    && tailSpan.nextSpanLocation == 0)
+                setCurrentSpan(tailSpan, tail->second.location, tail->second.posInStream);
+            else {
+                repo->tailSpans.erase(tail);
+                setCurrentSpan(it->header, it->location, it->posInStream);
+            }
+        }
+        else
+            setCurrentSpan(it->header, it->location, it->posInStream);
+
+        lock.unlock();
 
-        while (pos != currentSpanPosInStream) {
+        // past the spans visited so far, continue span-by-span
+        while (pos > currentSpanPosInStream + currentSpan.reservedLength) {
             // this should never happen
             if (currentSpanPosInStream > descr.length)
                 assert(false);
 
-            // is the 'pos' we're looking for within this span?
-            if (pos <= currentSpanPosInStream + currentSpan.reservedLength) {
-                posInCurrentSpan = (uint32_t)(pos - currentSpanPosInStream);
-                break;
-            }
+            if (currentSpan.nextSpanLocation == 0)
+                return error.unexpectedEndOfStream(), false;
 
-            SpanHeader_t nextSpan;
-            uint64_t nextSpanLocation = currentSpan.nextSpanLocation;
+            if (!gotoNextSpan())
+                return error.readError(), false;
+        }
 
-            if (nextSpanLocation != 0) {
-                if (!retrieveStruct(io, nextSpanLocation, nextSpan))
-                    return error.readError(), false;
-            }
-            else
-                return error.unexpectedEndOfStream(), false;
+        posInCurrentSpan = (uint32_t)(pos - currentSpanPosInStream);
+        return true;
+    }
+
+    bool RepositoryStream::gotoNextSpan() {
+        const uint64_t nextSpanLocation = currentSpan.nextSpanLocation;
+        const uint64_t nextSpanPosInStream = currentSpanPosInStream + currentSpan.reservedLength;
 
-            setCurrentSpan(nextSpan, nextSpanLocation, currentSpanPosInStream + currentSpan.reservedLength);
+        if (currentSpanIndex + 1 < spanIndex.size() && spanIndex[currentSpanIndex + 1].location == nextSpanLocation) {
+            const auto& next = spanIndex[currentSpanIndex + 1];
+            setCurrentSpan(next.header, next.location, next.posInStream);
+            return true;
         }
 
+        SpanHeader_t nextSpan;
+
+        if (readingAhead) {
+            // when spans follow each other in the file, the header will often be in the read-ahead buffer already
+            uint8_t spanHeaderBytes[SpanHeader_t::SIZE];
+            int result = readBuffered(nextSpanLocation, spanHeaderBytes, sizeof(spanHeaderBytes));
+
+            if (result == 0 || (result < 0
+                    && !io->getBytesAt(nextSpanLocation, spanHeaderBytes, sizeof(spanHeaderBytes))))
+                return false;
+
+            retrieveStruct(spanHeaderBytes, 0, nextSpan);
+        }
+        else if (!retrieveStruct(io, nextSpanLocation, nextSpan))
+            return false;
+
+        setCurrentSpan(nextSpan, nextSpanLocation, nextSpanPosInStream);
         return true;
     }
 
+    /*
+     *  Serve `count` bytes at `location` in the underlying ByteIO from the read-ahead buffer, refilling it if needed.
+     *
+     *  Return value:
+     *      1   if the bytes were copied into `buffer`
+     *      0   if an error occured
+     *      -1  if the range isn't suitable for buffering (and should be read directly)
+     */
+    int RepositoryStream::readBuffered(uint64_t location, uint8_t* buffer, size_t count) {
+        if (location >= readAheadLocation && location + count <= readAheadLocation + readAheadLength) {
+            memcpy(buffer, &readAheadBuffer[(size_t)(location - readAheadLocation)], count);
+            return 1;
+        }
+
+        const size_t readAheadSize = repo->readAheadSize;
+
+        // big reads are better done directly into the caller's buffer
+        if (count > readAheadSize / 2)
+            return -1;
+
+        const uint64_t ioSize = io->getSize();
+
+        if (location + count > ioSize)
+            return -1;
+
+        // one big read covering this and what's likely to follow
+        readAheadBuffer.resize(readAheadSize);
+        readAheadLocation = location;
+        readAheadLength = (size_t) std::min<uint64_t>(readAheadSize, ioSize - location);
+
+        if (!io->getBytesAt(readAheadLocation, &readAheadBuffer[0], readAheadLength)) {
+            readAheadLength = 0;
+            return 0;
+        }
+
+        memcpy(buffer, &readAheadBuffer[0], count);
+        return 1;
+    }
+
     size_t RepositoryStream::read(void* buffer_in, size_t length) {
         if (length == 0)
             return 0;
@@ -126,6 +295,32 @@ namespace bleb {
                 return readTotal;
         }
 
+        // Data segments are collected while walking the spans and then read with a single vectored call,
+        // which the backend can turn into a batch. Only span headers need to be read on the way in order to find
+        // the next span.
+        // Small reads continuing where the previous one ended are served from a read-ahead buffer instead.
+        const uint64_t startPos = pos;
+        readSegments.clear();
+
+        readingAhead = (pos == lastReadEnd && repo->readAheadSize > 0);
+
+        auto finishReads = [&]() -> size_t {
+            readingAhead = false;
+
+            if (!readSegments.empty() && !io->getBytesAtV(&readSegments[0], readSegments.size())) {
+                // we can't tell how much of the data made it
+                readTotal = 0;
+
+                pos = startPos;
+                haveCurrentSpan = false;
+
+                error.readError();
+            }
+
+            lastReadEnd = startPos + readTotal;
+            return readTotal;
+        };
+
         for (; length > 0;) {
             // start by checking whether we currently are within any span
 
@@ -134,12 +329,17 @@ namespace bleb {
             //diagnostic("%llu = %u - %llu\n", remainingBytesInSpan, currentSpan.usedLength, posInCurrentSpan);
             if (remainingBytesInSpan > 0) {
                 if (currentSpan.nextSpanLocation && currentSpan.usedLength < currentSpan.reservedLength)
-                    return error.repositoryCorruption("span not fully utilized"), readTotal;
+                    return error.repositoryCorruption("span not fully utilized"), finishReads();
 
                 const size_t read = (size_t) std::min<uint64_t>(remainingBytesInSpan, length);
+                const uint64_t location = currentSpanLocation + SpanHeader_t::SIZE + posInCurrentSpan;
 
-                if (!io->getBytesAt(currentSpanLocation + SpanHeader_t::SIZE + posInCurrentSpan, buffer, read))
-                    return error.readError(), readTotal;
+                int result = readingAhead ? readBuffered(location, buffer, read) : -1;
+
+                if (result == 0)
+                    return error.readError(), finishReads();
+                else if (result < 0)
+                    readSegments.push_back(ReadSegment {location, buffer, read});
 
                 posInCurrentSpan += read;
                 pos += read;
@@ -151,26 +351,163 @@ namespace bleb {
 
             if (length > 0) {
                 // continue in next span
-                SpanHeader_t nextSpan;
-                uint64_t nextSpanLocation = currentSpan.nextSpanLocation;
+                if (currentSpan.nextSpanLocation == 0)
+                    return error.unexpectedEndOfStream(), finishReads();
 
-                if (nextSpanLocation != 0) {
-                    if (!retrieveStruct(io, nextSpanLocation, nextSpan))
-                        return error.readError(), readTotal;
-                }
+                if (!gotoNextSpan())
+                    return error.readError(), finishReads();
+            }
+        }
+
+        return finishReads();
+    }
+
+    bool RepositoryStream::getExtents(uint64_t pos, uint64_t length, std::vector<ObjectExtent>& extents_out) {
+        if (length == 0)
+            return true;
+
+        if (pos + length > descr.length)
+            return false;
+
+        setPos(pos);
+
+        if (!haveCurrentSpan) {
+            if (!gotoRightSpan())
+                return false;
+        }
+
+        for (; length > 0;) {
+            const uint64_t remainingBytesInSpan = currentSpan.reservedLength - posInCurrentSpan;
+
+            if (remainingBytesInSpan > 0) {
+                const uint64_t count = std::min<uint64_t>(remainingBytesInSpan, length);
+                const uint64_t location = currentSpanLocation + SpanHeader_t::SIZE + posInCurrentSpan;
+
+                if (!extents_out.empty() && extents_out.back().location + extents_out.back().length == location)
+                    extents_out.back().length += count;
                 else
-                    return error.unexpectedEndOfStream(), readTotal;
+                    extents_out.push_back(ObjectExtent {location, count});
+
+                posInCurrentSpan += (uint32_t) count;
+                this->pos += count;
+                length -= count;
+            }
 
-                setCurrentSpan(nextSpan, nextSpanLocation, currentSpanPosInStream + currentSpan.reservedLength);
+            if (length > 0) {
+                if (currentSpan.nextSpanLocation == 0)
+                    return error.unexpectedEndOfStream(), false;
+
+                if (!gotoNextSpan())
+                    return error.readError(), false;
             }
         }
 
-        return readTotal;
+        return true;
+    }
+
+    bool RepositoryStream::defragment() {
+        if (descr.location == 0 || spanIndex.empty() || spanIndex[0].header.nextSpanLocation == 0)
+            return true;
+
+        if (descr.length > std::numeric_limits<uint32_t>::max())
+            return error(errNotSupported, "stream too long to fit in a single span"), false;
+
+        const uint64_t oldPos = pos;
+        const uint32_t length = (uint32_t) descr.length;
+
+        uint64_t newSpanLocation;
+        SpanHeader_t newSpan;
+
+        // the whole point is to end up with a single span, whatever the growth policy says
+        ExactFitSpanGrowthPolicy exactFit;
+
+        if (!repo->allocateSpan(newSpanLocation, newSpan, length, length, &exactFit, length))
+            return error.writeError(), false;
+
+        // copy the data over in big pieces
+        std::vector<uint8_t> buffer(std::min<size_t>(length, 1024 * 1024));
+
+        setPos(0);
+
+        for (uint32_t done = 0; done < length; ) {
+            const size_t count = std::min<size_t>(buffer.size(), length - done);
+
+            if (read(&buffer[0], count) != count)
+                return false;
+
+            if (!io->setBytesAt(newSpanLocation + SpanHeader_t::SIZE + done, &buffer[0], count))
+                return error.writeError(), false;
+
+            done += (uint32_t) count;
+        }
+
+        newSpan.usedLength = length;
+
+        if (!storeStruct(io, newSpanLocation, newSpan))
+            return error.writeError(), false;
+
+        // release the old chain, including any header updates still pending in write-back mode
+        if (!releaseSpansFrom(0, descr.location))
+            return false;
+
+        descr.location = newSpanLocation;
+        descrDirty = true;
+
+        setCurrentSpan(newSpan, newSpanLocation, 0);
+        pos = 0;
+        setPos(oldPos);
+
+        if (!writeBackMetadata())
+            return error.writeError(), false;
+
+        return true;
+    }
+
+    bool RepositoryStream::flush() {
+        if (!writeBackMetadata())
+            return false;
+
+        // for object streams, this is the Content Directory stream, which will in turn flush the Repository ByteIO
+        std::lock_guard<std::recursive_mutex> lock(repo->mutex);
+        return descrIO->flush();
+    }
+
+    const uint8_t* RepositoryStream::viewBytesAt(uint64_t pos, size_t count) {
+        if (count == 0 || pos + count > descr.length)
+            return nullptr;
+
+        setPos(pos);
+
+        if (!haveCurrentSpan) {
+            if (!gotoRightSpan())
+                return nullptr;
+        }
+
+        // only ranges which don't cross a span boundary can be viewed directly
+        if (posInCurrentSpan + count > currentSpan.reservedLength)
+            return nullptr;
+
+        return io->viewBytesAt(currentSpanLocation + SpanHeader_t::SIZE + posInCurrentSpan, count);
     }
 
     void RepositoryStream::setCurrentSpan(const SpanHeader_t& span, uint64_t spanLocation, uint64_t spanPosInStream) {
+        // `span` might live in spanIndex, so copy it before the index is modified
         currentSpan = span;
 
+        // the index is ordered by position in stream, but can have gaps (when jumping to the tail span)
+        auto it = std::upper_bound(spanIndex.begin(), spanIndex.end(), spanPosInStream,
+                [](uint64_t pos, const SpanIndexEntry& entry) { return pos < entry.posInStream; });
+
+        if (it != spanIndex.begin() && (it - 1)->location == spanLocation)
+            currentSpanIndex = (it - 1) - spanIndex.begin();
+        else {
+            // a span we haven't seen yet
+            assert(!spanIndex.empty() || spanPosInStream == 0);
+
+            it = spanIndex.insert(it, SpanIndexEntry {spanPosInStream, spanLocation, currentSpan, false});
+            currentSpanIndex = it - spanIndex.begin();
+        }
+
         currentSpanLocation = spanLocation;
         currentSpanPosInStream = spanPosInStream;
         posInCurrentSpan = 0;
@@ -178,13 +515,121 @@ namespace bleb {
         haveCurrentSpan = true;
     }
 
+    bool RepositoryStream::writeBackMetadata() {
+        if (numDirtySpanHeaders > 0) {
+            headerBytes.resize(numDirtySpanHeaders * SpanHeader_t::SIZE);
+            writeSegments.clear();
+
+            // the index is in stream order, which tends to be file order too
+            for (auto& entry : spanIndex) {
+                if (entry.dirty) {
+                    uint8_t* bytes = &headerBytes[writeSegments.size() * SpanHeader_t::SIZE];
+                    serialize(entry.header, bytes);
+                    writeSegments.push_back(WriteSegment {entry.location, bytes, SpanHeader_t::SIZE});
+                }
+            }
+
+            // keep the headers dirty if the write fails, so that it is retried on the next flush
+            if (!io->setBytesAtV(&writeSegments[0], writeSegments.size()))
+                return false;
+
+            for (auto& entry : spanIndex)
+                entry.dirty = false;
+
+            numDirtySpanHeaders = 0;
+        }
+
+        if (descrDirty) {
+            // the Stream Descriptor of an object lives in the Content Directory, which is shared by all streams
+            std::lock_guard<std::recursive_mutex> lock(repo->mutex);
+
+            if (!storeStruct(descrIO, descrPos, descr))
+                return false;
+
+            descrDirty = false;
+        }
+
+        return true;
+    }
+
     void RepositoryStream::setLength(uint64_t length) {
-        // TODO: release unneeded spans
+        if (length < descr.length && descr.location != 0) {
+            // find the span holding the last byte to be kept
+            const uint64_t oldPos = pos;
+            pos = (length > 0) ? length - 1 : 0;
+
+            if (gotoRightSpan() && currentSpan.nextSpanLocation != 0) {
+                const size_t keepIndex = currentSpanIndex;
+
+                if (releaseSpansFrom(keepIndex + 1, currentSpan.nextSpanLocation)) {
+                    auto& entry = spanIndex[keepIndex];
+                    entry.header.nextSpanLocation = 0;
+                    entry.header.usedLength = (uint32_t) std::min<uint64_t>(entry.header.usedLength,
+                            length - entry.posInStream);
+
+                    if (writeBack) {
+                        if (!entry.dirty) {
+                            entry.dirty = true;
+                            numDirtySpanHeaders++;
+                        }
+                    }
+                    else if (!storeStruct(io, entry.location, entry.header))
+                        error.writeError();
+                }
+            }
+
+            this->pos = oldPos;
+            haveCurrentSpan = false;
+        }
 
         descr.length = length;
         descrDirty = true;
     }
 
+    /*
+     *  Give the chain of spans starting at `location` back to the Repository. `index` is where the first of them would
+     *  be in spanIndex; this and all following entries are dropped. The caller is responsible for unlinking the chain.
+     */
+    bool RepositoryStream::releaseSpansFrom(size_t index, uint64_t location) {
+        assert(index <= spanIndex.size());
+        readAheadLength = 0;
+        haveCurrentSpan = false;
+        modified = true;
+
+        // whatever was remembered as the end of this stream might be among the released spans
+        std::lock_guard<std::recursive_mutex> lock(repo->mutex);
+        repo->tailSpans.erase(descr.location);
+
+        bool success = true;
+
+        for (size_t i = index; location != 0; ) {
+            SpanHeader_t span;
+
+            // spans that haven't been visited yet need their header read
+            if (i < spanIndex.size() && spanIndex[i].location == location)
+                span = spanIndex[i++].header;
+            else if (!retrieveStruct(io, location, span)) {
+                success = false;
+                break;
+            }
+
+            repo->releaseSpan(location, span.reservedLength);
+            location = span.nextSpanLocation;
+        }
+
+        for (size_t i = index; i < spanIndex.size(); i++) {
+            if (spanIndex[i].dirty)
+                numDirtySpanHeaders--;
+        }
+
+        spanIndex.resize(index);
+
+        if (!success)
+            error.readError();
+
+        return success;
+    }
+
     void RepositoryStream::setPos(uint64_t pos) {
         if (this->pos != pos) {
             this->pos = pos;
@@ -202,22 +647,39 @@ namespace bleb {
     }
 
     size_t RepositoryStream::write(const void* buffer_in, size_t length) {
+        return (size_t) writeOrClear(reinterpret_cast<const uint8_t*>(buffer_in), length);
+    }
+
+    /*
+     *  Write `length` bytes from `buffer` at the current position, or zeroes if `buffer` is null.
+     *  Zeroing is delegated to ByteIO::clearBytesAt, one call per span, and skipped entirely for spans allocated
+     *  along the way (those are zeroed by allocateSpan already).
+     */
+    uint64_t RepositoryStream::writeOrClear(const uint8_t* buffer, uint64_t length) {
         if (isReadOnly || length == 0)
             return 0;
 
-        const uint8_t* buffer = reinterpret_cast<const uint8_t*>(buffer_in);
+        // one span can't be longer than 4 GiB; don't ask for more than a fraction of that at once
+        const uint64_t maxAllocationRequest = (uint64_t) 1 << 30;
+
+        uint64_t writtenTotal = 0;
+        bool currentSpanIsNew = false;
 
-        size_t writtenTotal = 0;
+        modified = true;
+        readAheadLength = 0;
 
         if (!haveCurrentSpan) {
             if (descr.location == 0) {
                 // the block is empty; allocate initial span
                 uint64_t firstSpanLocation;
+                SpanHeader_t firstSpan;
 
-                if (!repo->allocateSpan(firstSpanLocation, firstSpan, initialLengthHint, length))
+                if (!repo->allocateSpan(firstSpanLocation, firstSpan, initialLengthHint,
+                        std::min(length, maxAllocationRequest), spanGrowthPolicy, buffer ? length : 0))
                     return writtenTotal;
 
                 setCurrentSpan(firstSpan, firstSpanLocation, 0);
+                currentSpanIsNew = true;
 
                 descr.location = firstSpanLocation;
                 descrDirty = true;
@@ -229,6 +691,106 @@ namespace bleb {
             }
         }
 
+        // Data and updated span headers are collected and then written with a single vectored call.
+        // Each touched span header is only written once, after we're done with the span.
+        // The stream's metadata is updated as we go, so remember enough to undo that if the write fails.
+        const uint64_t startPos = pos;
+        const uint64_t startLength = descr.length;
+        const bool startDescrDirty = descrDirty;
+        writeSegments.clear();
+        clearSegments.clear();
+        headerUpdates.clear();
+        originalHeaders.clear();
+
+        bool currentSpanDirty = false;
+
+        // spans allocated during this call, from spanIndex[firstNewSpanIndex] on
+        size_t firstNewSpanIndex = 0;
+        uint64_t firstNewSpanLocation = 0;
+
+        auto rememberCurrentSpan = [&]() {
+            if (firstNewSpanLocation != 0 && currentSpanIndex >= firstNewSpanIndex)
+                return;
+
+            for (const auto& original : originalHeaders) {
+                if (original.first == currentSpanIndex)
+                    return;
+            }
+
+            originalHeaders.emplace_back(currentSpanIndex, spanIndex[currentSpanIndex].header);
+        };
+
+        auto rollBack = [&]() {
+            for (const auto& original : originalHeaders) {
+                spanIndex[original.first].header = original.second;
+
+                // some of the headers might have made it to the disk
+                if (!writeBack)
+                    storeStruct(io, spanIndex[original.first].location, original.second);
+            }
+
+            if (firstNewSpanLocation != 0)
+                releaseSpansFrom(firstNewSpanIndex, firstNewSpanLocation);
+
+            descr.length = startLength;
+            descrDirty = startDescrDirty;
+        };
+
+        auto finishWrites = [&]() -> uint64_t {
+            if (currentSpanDirty)
+                headerUpdates.push_back(currentSpanIndex);
+
+            if (!writeBack) {
+                headerBytes.resize(headerUpdates.size() * SpanHeader_t::SIZE);
+
+                for (size_t i = 0; i < headerUpdates.size(); i++) {
+                    const auto& entry = spanIndex[headerUpdates[i]];
+
+                    serialize(entry.header, &headerBytes[i * SpanHeader_t::SIZE]);
+                    writeSegments.push_back(WriteSegment {entry.location, &headerBytes[i * SpanHeader_t::SIZE],
+                            SpanHeader_t::SIZE});
+                }
+            }
+
+            // in file order, so that adjacent headers and data can be merged into a single transfer
+            std::sort(writeSegments.begin(), writeSegments.end(),
+                    [](const WriteSegment& a, const WriteSegment& b) { return a.pos < b.pos; });
+
+            bool success = writeSegments.empty() || io->setBytesAtV(&writeSegments[0], writeSegments.size());
+
+            for (const auto& segment : clearSegments) {
+                if (!success)
+                    break;
+
+                success = io->clearBytesAt(segment.first, segment.second);
+            }
+
+            if (!success) {
+                // we can't tell how much of the data made it, so pretend none of it did
+                writtenTotal = 0;
+
+                pos = startPos;
+                haveCurrentSpan = false;
+                rollBack();
+
+                error.writeError();
+            }
+            else if (writeBack) {
+                // just remember the header to be written later
+                for (size_t index : headerUpdates) {
+                    if (!spanIndex[index].dirty) {
+                        spanIndex[index].dirty = true;
+                        numDirtySpanHeaders++;
+                    }
+                }
+            }
+
+            if (numDirtySpanHeaders >= maxDirtySpanHeaders && !writeBackMetadata())
+                error.writeError();
+
+            return writtenTotal;
+        };
+
         for (; length > 0;) {
             // start by checking whether we currently are within any span
 
@@ -236,9 +798,14 @@ namespace bleb {
 
             if (remainingBytesInSpan > 0) {
                 const size_t written = (size_t) std::min<uint64_t>(remainingBytesInSpan, length);
+                const uint64_t location = currentSpanLocation + SpanHeader_t::SIZE + posInCurrentSpan;
 
-                if (!io->setBytesAt(currentSpanLocation + SpanHeader_t::SIZE + posInCurrentSpan, buffer, written))
-                    return error.writeError(), false;
+                if (buffer) {
+                    writeSegments.push_back(WriteSegment {location, buffer, written});
+                    buffer += written;
+                }
+                else if (!currentSpanIsNew)
+                    clearSegments.emplace_back(location, written);
 
                 posInCurrentSpan += written;
                 pos += written;
@@ -249,52 +816,59 @@ namespace bleb {
                     descrDirty = true;
                 }
 
-                buffer += written;
                 length -= written;
 
-                currentSpan.usedLength = std::max(currentSpan.usedLength, posInCurrentSpan);
-
-                if (!storeStruct(io, currentSpanLocation, currentSpan))
-                    return error.writeError(), writtenTotal;
+                if (posInCurrentSpan > currentSpan.usedLength) {
+                    currentSpan.usedLength = posInCurrentSpan;
+                    currentSpanDirty = true;
+                }
 
-                // we cache firstSpan, so it might need to be updated
-                if (currentSpanPosInStream == 0)
-                    firstSpan = currentSpan;
+                rememberCurrentSpan();
+                spanIndex[currentSpanIndex].header = currentSpan;
             }
 
             if (length > 0) {
                 // continue in next span
-                SpanHeader_t nextSpan;
+                if (currentSpan.nextSpanLocation != 0) {
+                    // next span had been already allocated
+                    if (currentSpanDirty)
+                        headerUpdates.push_back(currentSpanIndex);
 
-                uint64_t nextSpanLocation = currentSpan.nextSpanLocation;
+                    currentSpanDirty = false;
 
-                if (nextSpanLocation != 0) {
-                    // next span had been already allocated
+                    if (!gotoNextSpan())
+                        return error.readError(), finishWrites();
 
-                    if (!retrieveStruct(io, nextSpanLocation, nextSpan))
-                        return error.readError(), writtenTotal;
+                    currentSpanIsNew = false;
                 }
                 else {
                     // allocate a new span to hold the rest of the data
+                    uint64_t nextSpanLocation;
+                    SpanHeader_t nextSpan;
 
-                    if (!repo->allocateSpan(nextSpanLocation, nextSpan, descr.length, length))
-                        return writtenTotal;
+                    if (!repo->allocateSpan(nextSpanLocation, nextSpan, descr.length,
+                            std::min(length, maxAllocationRequest), spanGrowthPolicy, buffer ? length : 0))
+                        return finishWrites();
 
                     // update CURRENT span to point to the NEW span
                     currentSpan.nextSpanLocation = nextSpanLocation;
+                    rememberCurrentSpan();
+                    spanIndex[currentSpanIndex].header = currentSpan;
 
-                    if (!storeStruct(io, currentSpanLocation, currentSpan))
-                        return error.writeError(), writtenTotal;
+                    headerUpdates.push_back(currentSpanIndex);
+                    currentSpanDirty = false;
 
-                    // we cache firstSpan, so it might need to be updated
-                    if (currentSpanPosInStream == 0)
-                        firstSpan = currentSpan;
-                }
+                    setCurrentSpan(nextSpan, nextSpanLocation, currentSpanPosInStream + currentSpan.reservedLength);
+                    currentSpanIsNew = true;
 
-                setCurrentSpan(nextSpan, nextSpanLocation, currentSpanPosInStream + currentSpan.reservedLength);
+                    if (firstNewSpanLocation == 0) {
+                        firstNewSpanIndex = currentSpanIndex;
+                        firstNewSpanLocation = nextSpanLocation;
+                    }
+                }
             }
         }
 
-        return writtenTotal;
+        return finishWrites();
     }
 }
@@ -5,6 +5,9 @@
 
 #include "on_disk_structures.hpp"
 
+#include <utility>
+#include <vector>
+
 namespace bleb {
 class RepositoryStream : public ByteIO {
 public:
@@ -20,6 +23,12 @@ public:
 
     void setInitialLengthHint(uint32_t initialLengthHint) { this->initialLengthHint = initialLengthHint; }
 
+    // nullptr means the Repository's policy
+    void setSpanGrowthPolicy(SpanGrowthPolicy* policy) { this->spanGrowthPolicy = policy; }
+
+    // Count this stream among those opened through Repository::openStream for as long as it exists
+    void setOpenedByUser();
+
     virtual uint64_t getSize() override {
         return descr.length;
     }
@@ -33,26 +42,63 @@ public:
     }
 
     virtual bool clearBytesAt(uint64_t pos, uint64_t count) override;
+    virtual const uint8_t* viewBytesAt(uint64_t pos, size_t count) override;
+
+    // Persist span headers deferred by write-back mode and the Stream Descriptor, then flush the underlying ByteIO
+    virtual bool flush() override;
 
     uint64_t getPos() {
         return pos;
     }
 
+    // Append the locations in the underlying ByteIO holding `length` bytes of the stream starting at `pos`
+    bool getExtents(uint64_t pos, uint64_t length, std::vector<ObjectExtent>& extents_out);
+
+    // Move the whole stream into a single newly allocated span. Does nothing if it already is in one piece.
+    bool defragment();
+
+    // Shrinking the stream releases the spans past the new end (except the first one)
     void setLength(uint64_t length);
     void setPos(uint64_t pos);
 
+    // Position the stream at its end, ready for appending
+    bool seekToEnd();
+
+    // Make sure an empty stream has a first span of at least `length` bytes (up to the maximum span length),
+    // replacing the current one if it's smaller. Does nothing for streams which already contain data.
+    bool reserve(uint64_t length);
+
     size_t read(void* buffer_in, size_t length);
     size_t write(const void* buffer_in, size_t length);
 
 private:
     RepositoryStream(const RepositoryStream&) = delete;
 
+    // What we know about a span of the stream
+    struct SpanIndexEntry {
+        uint64_t posInStream;
+        uint64_t location;
+        SpanHeader_t header;
+        bool dirty;             // changed, but not written yet (write-back mode only)
+    };
+
+    // in write-back mode, span headers are written out once this many of them are dirty
+    enum { maxDirtySpanHeaders = 64 };
+
     bool gotoRightSpan();
+    bool gotoNextSpan();
     void setCurrentSpan(const SpanHeader_t& span, uint64_t spanLocation, uint64_t spanPosInStream);
+    bool writeBackMetadata();
+    bool releaseSpansFrom(size_t index, uint64_t location);
+    int readBuffered(uint64_t location, uint8_t* buffer, size_t count);
+    uint64_t writeOrClear(const uint8_t* buffer, uint64_t length);
 
     Repository* repo;
     ByteIO* io;
     bool isReadOnly;
+    bool isOpenedByUser;
+    bool writeBack;
+    bool modified;
 
     ByteIO* descrIO;
     uint64_t descrPos;
@@ -62,11 +108,33 @@ private:
     uint64_t pos;
 
     bool haveCurrentSpan;
-    SpanHeader_t firstSpan, currentSpan;
+    SpanHeader_t currentSpan;
     uint64_t currentSpanLocation, currentSpanPosInStream;
     uint32_t posInCurrentSpan;
 
+    // Spans of the stream that have been visited, in stream order (always including the first one).
+    // Seeking to a span that has been seen before is a binary search with no I/O.
+    std::vector<SpanIndexEntry> spanIndex;
+    size_t currentSpanIndex;
+    size_t numDirtySpanHeaders;
+
     uint32_t initialLengthHint;
+    SpanGrowthPolicy* spanGrowthPolicy;
+
+    // read-ahead for sequential reads; contains bytes of the underlying ByteIO starting at readAheadLocation
+    bool readingAhead;
+    std::vector<uint8_t> readAheadBuffer;
+    uint64_t readAheadLocation;
+    size_t readAheadLength;
+    uint64_t lastReadEnd;
+
+    // scratch space for vectored transfers
+    std::vector<ReadSegment> readSegments;
+    std::vector<WriteSegment> writeSegments;
+    std::vector<std::pair<uint64_t, uint64_t>> clearSegments;  // location, length
+    std::vector<size_t> headerUpdates;      // indices into spanIndex
+    std::vector<std::pair<size_t, SpanHeader_t>> originalHeaders;   // to roll back a failed write
+    std::vector<uint8_t> headerBytes;
 
     ErrorStruct_ error;
 };
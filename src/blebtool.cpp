@@ -26,6 +26,30 @@ unique_ptr<bleb::Repository> open(const std::string& path, bool canCreateNew) {
     return std::move(repo);
 }
 
+int executeCompactCommand(std::string repository, std::string outputRepository) {
+    auto repo = open(repository, false);
+
+    if (repo == nullptr)
+        return -1;
+
+    FILE* output = bleb::StdioFileByteIO::getFile(outputRepository.c_str(), true);
+
+    if (!output) {
+        fprintf(stderr, "blebtool: failed to open file '%s'\n", outputRepository.c_str());
+        return -1;
+    }
+
+    bleb::StdioFileByteIO outputIO(output, true);
+
+    if (!repo->compactTo(&outputIO)) {
+        fprintf(stderr, "blebtool: failed to compact repository into '%s': %s\n", outputRepository.c_str(),
+                repo->getErrorDesc());
+        return -1;
+    }
+
+    return 0;
+}
+
 int executeGetCommand(std::string objectName, std::string repository, std::string outputFile) {
     auto repo = open(repository, false);
 
@@ -97,22 +121,39 @@ int executePutCommand(std::string objectName, std::string repository, std::strin
         repo->setObjectContents(objectName.c_str(), text.c_str(), text.length(), flags);
     }
     else {
-        std::unique_ptr<bleb::ByteIO> stream(repo->openStream(objectName.c_str(),
-                                                              bleb::kStreamCreate | bleb::kStreamTruncate));
-        if (!stream) {
-            fprintf(stderr, "blebtool: failed to open stream '%s' for writing\n", objectName.c_str());
+        FILE* input = inputFile.empty() ? stdin : fopen(inputFile.c_str(), "rb");
+
+        if (!input) {
+            fprintf(stderr, "blebtool: failed to open '%s' for input\n", inputFile.c_str());
             return -1;
         }
 
-        size_t pos = 0;
+        // if the size is known in advance, the object can be stored in a single span
+        uint64_t expectedSize = 0;
 
-        FILE* input = inputFile.empty() ? stdin : fopen(inputFile.c_str(), "rb");
+        if (input != stdin && fseek(input, 0, SEEK_END) == 0) {
+            long size = ftell(input);
+
+            if (size > 0)
+                expectedSize = (uint64_t) size;
+
+            fseek(input, 0, SEEK_SET);
+        }
+
+        std::unique_ptr<bleb::ByteIO> stream(repo->openStream(objectName.c_str(),
+                                                              bleb::kStreamCreate | bleb::kStreamTruncate,
+                                                              expectedSize));
+        if (!stream) {
+            fprintf(stderr, "blebtool: failed to open stream '%s' for writing\n", objectName.c_str());
+
+            if (input != stdin)
+                fclose(input);
 
-        if (!input) {
-            fprintf(stderr, "blebtool: failed to open '%s' for input\n", inputFile.c_str());
             return -1;
         }
 
+        size_t pos = 0;
+
         while (!feof(input)) {
             uint8_t in[4096];
             size_t got = fread(in, 1, sizeof(in), input);
@@ -137,6 +178,14 @@ int main(int argc, const char **argv)
     args::ArgumentParser p("blebtool");
     args::Group commands(p, "commands");
 
+    args::Command compact(commands, "compact", "write a compacted copy of the repository", [&](args::Subparser &parser) {
+        args::ValueFlag<std::string> repository(parser, "repository", "filename of the repository", {'R'});
+        args::ValueFlag<std::string> outputRepository(parser, "outputRepository", "filename of the new repository (must not exist or be empty)", {'o'});
+        parser.Parse();
+
+        return executeCompactCommand(repository.Get(), outputRepository.Get());
+    });
+
     args::Command get(commands, "get", "retrieve an object from the repository", [&](args::Subparser &parser) {
         args::Positional<std::string> objectName(parser, "objectName", "name of the object to retrieve");
         args::ValueFlag<std::string> repository(parser, "repository", "filename of the repository", {'R'});
@@ -0,0 +1,50 @@
+#ifndef bleb_test_counting_byteio_hpp
+#define bleb_test_counting_byteio_hpp
+
+#include <bleb/byteio_vector.hpp>
+
+#include <algorithm>
+
+// Counts the reads and writes reaching the backend
+class CountingByteIO : public bleb::VectorByteIO {
+public:
+    CountingByteIO() : VectorByteIO(0, true) {}
+
+    bool getBytesAt(uint64_t pos, uint8_t* buffer, size_t count) override {
+        reads++;
+        maxReadEnd = std::max<uint64_t>(maxReadEnd, pos + count);
+        return VectorByteIO::getBytesAt(pos, buffer, count);
+    }
+
+    bool setBytesAt(uint64_t pos, const uint8_t* buffer, size_t count) override {
+        if (failWrites)
+            return false;
+
+        writes++;
+        return VectorByteIO::setBytesAt(pos, buffer, count);
+    }
+
+    bool setBytesAtV(const bleb::WriteSegment* segments, size_t count) override {
+        if (failVectoredWrites)
+            return false;
+
+        return VectorByteIO::setBytesAtV(segments, count);
+    }
+
+    // Open a separate Repository over a snapshot of the current contents
+    void snapshotTo(bleb::VectorByteIO& snapshot) {
+        snapshot.setBytesAt(0, viewBytesAt(0, (size_t) getSize()), (size_t) getSize());
+    }
+
+    int reads = 0;
+    int writes = 0;
+    uint64_t maxReadEnd = 0;
+
+    // simulate a full disk
+    bool failWrites = false;
+
+    // only fail the batched writes done by streams, but not single writes like those done by span allocation
+    bool failVectoredWrites = false;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "catch.hpp"
+
+#include <bleb/byteio_cache.hpp>
+#include <bleb/byteio_vector.hpp>
+#include <bleb/repository.hpp>
+
+#include <vector>
+
+TEST_CASE("CachingByteIO serves repeated reads from memory", "[CachingByteIO]") {
+    bleb::VectorByteIO vbio(0, true);
+
+    std::vector<uint8_t> data(1000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t) i;
+
+    REQUIRE(vbio.setBytesAt(0, &data[0], data.size()));
+
+    bleb::CachingByteIO cbio(&vbio, 64, 256);
+    uint8_t readBuffer[16];
+
+    REQUIRE(cbio.getSize() == data.size());
+    REQUIRE(cbio.getBytesAt(60, readBuffer, sizeof(readBuffer)));
+    REQUIRE(memcmp(readBuffer, &data[60], sizeof(readBuffer)) == 0);
+    REQUIRE(cbio.getMisses() == 2);
+
+    REQUIRE(cbio.getBytesAt(64, readBuffer, sizeof(readBuffer)));
+    REQUIRE(cbio.getHits() == 1);
+
+    // fill the cache up to its budget of 4 blocks, then one more
+    for (uint64_t pos = 128; pos < 5 * 64; pos += 64)
+        REQUIRE(cbio.getBytesAt(pos, readBuffer, sizeof(readBuffer)));
+
+    REQUIRE(cbio.getEvictions() == 1);
+
+    REQUIRE(!cbio.getBytesAt(data.size() - 1, readBuffer, 2));
+}
+
+TEST_CASE("CachingByteIO stays coherent with writes", "[CachingByteIO]") {
+    bleb::VectorByteIO vbio(0, true);
+    bleb::CachingByteIO cbio(&vbio, 64, 1024);
+
+    const uint8_t testData[] = u8"Hello, World";
+    uint8_t readBuffer[sizeof(testData)];
+
+    REQUIRE(cbio.setBytesAt(0, testData, sizeof(testData)));
+    REQUIRE(cbio.getBytesAt(0, readBuffer, sizeof(readBuffer)));
+    REQUIRE(memcmp(readBuffer, testData, sizeof(testData)) == 0);
+
+    // extend the cached partial block, then overwrite part of it
+    REQUIRE(cbio.setBytesAt(sizeof(testData), testData, sizeof(testData)));
+    REQUIRE(cbio.clearBytesAt(0, 5));
+    REQUIRE(cbio.getSize() == 2 * sizeof(testData));
+
+    REQUIRE(cbio.getBytesAt(sizeof(testData), readBuffer, sizeof(readBuffer)));
+    REQUIRE(memcmp(readBuffer, testData, sizeof(testData)) == 0);
+
+    REQUIRE(cbio.getBytesAt(0, readBuffer, sizeof(readBuffer)));
+    REQUIRE(memcmp(readBuffer, "\0\0\0\0\0, World", sizeof(testData)) == 0);
+}
+
+TEST_CASE("Repository can be used through CachingByteIO", "[CachingByteIO]") {
+    bleb::VectorByteIO vbio(0, true);
+    bleb::CachingByteIO cbio(&vbio, 256, 4096);
+    bleb::Repository repo(&cbio);
+
+    REQUIRE(repo.open(true));
+
+    for (int i = 0; i < 50; i++) {
+        char name[20];
+        snprintf(name, sizeof(name), "object%d", i);
+        repo.setObjectContents(name, name, bleb::kPreferInlinePayload);
+    }
+
+    cbio.resetCounters();
+
+    uint8_t* contents = nullptr;
+    size_t size;
+    repo.getObjectContents("object49", contents, size);
+    REQUIRE(contents != nullptr);
+    REQUIRE(size == 8);
+    REQUIRE(memcmp(contents, "object49", size) == 0);
+    free(contents);
+
+    REQUIRE(cbio.getHits() > cbio.getMisses());
+}
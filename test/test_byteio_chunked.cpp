@@ -0,0 +1,86 @@
+#include "catch.hpp"
+
+#include <bleb/byteio_chunked.hpp>
+#include <bleb/byteio_vector.hpp>
+#include <bleb/repository.hpp>
+
+#include <algorithm>
+#include <vector>
+
+TEST_CASE("ChunkedByteIO can be written to and read from across chunks", "[ChunkedByteIO]") {
+    bleb::ChunkedByteIO cbio(16);
+
+    const uint8_t testData[] = u8"Hello, World! Hello, World!";
+    uint8_t readBuffer[sizeof(testData)];
+
+    REQUIRE(cbio.getSize() == 0);
+    REQUIRE(cbio.setBytesAt(10, testData, sizeof(testData)));
+    REQUIRE(cbio.getSize() == 10 + sizeof(testData));
+    REQUIRE(cbio.getBytesAt(10, readBuffer, sizeof(readBuffer)));
+    REQUIRE(memcmp(testData, readBuffer, sizeof(testData)) == 0);
+    REQUIRE(!cbio.getBytesAt(11, readBuffer, sizeof(readBuffer)));
+
+    REQUIRE(cbio.clearBytesAt(12, 3));
+    REQUIRE(cbio.getBytesAt(10, readBuffer, 6));
+    REQUIRE(memcmp(readBuffer, "He\0\0\0,", 6) == 0);
+
+    // the gap before the first write reads as zeroes
+    REQUIRE(cbio.getBytesAt(0, readBuffer, 10));
+    REQUIRE(memcmp(readBuffer, "\0\0\0\0\0\0\0\0\0\0", 10) == 0);
+
+    REQUIRE(cbio.viewBytesAt(16, 16) != nullptr);
+    REQUIRE(cbio.viewBytesAt(15, 2) == nullptr);
+}
+
+TEST_CASE("ChunkedByteIO contents can be exported", "[ChunkedByteIO]") {
+    bleb::ChunkedByteIO cbio(4096);
+    bleb::Repository repo(&cbio);
+
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(20000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 7);
+
+    repo.setObjectContents("stream", &data[0], data.size(), 0);
+    repo.close();
+
+    std::vector<bleb::WriteSegment> segments;
+    cbio.getSegments(segments);
+    REQUIRE(segments.size() == (cbio.getSize() + 4095) / 4096);
+
+    bleb::VectorByteIO vbio(0, true);
+    REQUIRE(cbio.writeTo(&vbio));
+    REQUIRE(vbio.getSize() == cbio.getSize());
+
+    bleb::Repository copy(&vbio);
+    REQUIRE(copy.open(false));
+
+    uint8_t* contents = nullptr;
+    size_t size;
+    copy.getObjectContents("stream", contents, size);
+    REQUIRE(contents != nullptr);
+
+    REQUIRE(size == data.size());
+    REQUIRE(memcmp(contents, &data[0], size) == 0);
+    free(contents);
+}
+
+TEST_CASE("ChunkedByteIO can be truncated", "[ChunkedByteIO]") {
+    bleb::ChunkedByteIO cbio(1024);
+
+    std::vector<uint8_t> data(5000, 0xAB);
+    REQUIRE(cbio.setBytesAt(0, &data[0], data.size()));
+
+    REQUIRE(!cbio.truncate(6000));
+    REQUIRE(cbio.truncate(1500));
+    REQUIRE(cbio.getSize() == 1500);
+
+    // growing again must bring back zeroes, not the old data
+    REQUIRE(cbio.clearBytesAt(1500, 3000));
+
+    std::vector<uint8_t> readBuffer(3000);
+    REQUIRE(cbio.getBytesAt(1500, &readBuffer[0], readBuffer.size()));
+    REQUIRE(std::count(readBuffer.begin(), readBuffer.end(), 0) == (long) readBuffer.size());
+}
@@ -0,0 +1,91 @@
+#include "catch.hpp"
+
+#include <bleb/byteio_direct.hpp>
+#include <bleb/byteio_vector.hpp>
+#include <bleb/repository.hpp>
+
+#include <vector>
+
+TEST_CASE("DirectFdByteIO handles unaligned transfers", "[DirectFdByteIO]") {
+    FILE* f = tmpfile();
+    REQUIRE(f != nullptr);
+
+    std::vector<uint8_t> data(3 * 4096 + 100);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 7);
+
+    {
+        bleb::DirectFdByteIO dbio(fileno(f), false, 4096, 8192);
+
+        // unaligned position and length, then partially overwrite it
+        REQUIRE(dbio.setBytesAt(10, &data[0], data.size()));
+        REQUIRE(dbio.setBytesAt(5000, &data[100], 50));
+        REQUIRE(dbio.getSize() == 10 + data.size());
+
+        memcpy(&data[4990], &data[100], 50);
+
+        std::vector<uint8_t> readBuffer(data.size());
+        REQUIRE(dbio.getBytesAt(10, &readBuffer[0], readBuffer.size()));
+        REQUIRE(readBuffer == data);
+        REQUIRE(!dbio.getBytesAt(11, &readBuffer[0], readBuffer.size()));
+    }
+
+#if defined(O_DIRECT)
+    // the descriptor is still ours, so it must be left the way we passed it in
+    REQUIRE((fcntl(fileno(f), F_GETFL) & O_DIRECT) == 0);
+#endif
+
+    // block-sized writes must have been trimmed to the logical size on close
+    fseek(f, 0, SEEK_END);
+    REQUIRE((size_t) ftell(f) == 10 + data.size());
+
+    fclose(f);
+}
+
+TEST_CASE("Span data can be aligned", "[DirectFdByteIO]") {
+    bleb::VectorByteIO vbio(0, true);
+    bleb::Repository repo(&vbio);
+
+    repo.setSpanDataAlignment(4096);
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(10000, 0x55);
+    repo.setObjectContents("stream", &data[0], data.size(), 0);
+
+    const uint8_t* contents;
+    size_t size;
+    REQUIRE(repo.getObjectView("stream", contents, size));
+    REQUIRE(size == data.size());
+    REQUIRE((contents - vbio.viewBytesAt(0, 1)) % 4096 == 0);
+}
+
+TEST_CASE("Repository can be used through DirectFdByteIO", "[DirectFdByteIO]") {
+    FILE* f = tmpfile();
+    REQUIRE(f != nullptr);
+
+    bleb::DirectFdByteIO dbio(fileno(f), false);
+    bleb::Repository repo(&dbio);
+
+    repo.setSpanDataAlignment(4096);
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(100000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 13);
+
+    repo.setObjectContents("stream", &data[0], data.size(), 0);
+
+    uint8_t* contents = nullptr;
+    size_t size;
+    repo.getObjectContents("stream", contents, size);
+    REQUIRE(contents != nullptr);
+
+    REQUIRE(size == data.size());
+    REQUIRE(memcmp(contents, &data[0], size) == 0);
+    free(contents);
+
+    repo.close();
+    fclose(f);
+}
@@ -0,0 +1,149 @@
+#include "catch.hpp"
+
+#include <bleb/byteio_mmap.hpp>
+#include <bleb/byteio_stdio.hpp>
+#include <bleb/repository.hpp>
+
+#include <vector>
+
+TEST_CASE("MmapByteIO can be read from", "[MmapByteIO]") {
+    FILE* f = tmpfile();
+    REQUIRE(f != nullptr);
+
+    const uint8_t testData[] = u8"Hello, World";
+    REQUIRE(fwrite(testData, 1, sizeof(testData), f) == sizeof(testData));
+    fflush(f);
+
+    bleb::MmapByteIO mbio(fileno(f), false);
+    uint8_t readBuffer[sizeof(testData)];
+
+    REQUIRE(mbio.isMapped());
+    REQUIRE(mbio.getSize() == sizeof(testData));
+    REQUIRE(mbio.getBytesAt(0, readBuffer, sizeof(readBuffer)) == true);
+    REQUIRE(memcmp(testData, readBuffer, sizeof(testData)) == 0);
+    REQUIRE(mbio.getBytesAt(1, readBuffer, sizeof(readBuffer)) == false);
+    REQUIRE(mbio.setBytesAt(0, testData, sizeof(testData)) == false);
+
+    const uint8_t* view = mbio.viewBytesAt(7, 5);
+    REQUIRE(view != nullptr);
+    REQUIRE(memcmp(view, "World", 5) == 0);
+
+    mbio.close();
+    fclose(f);
+}
+
+TEST_CASE("Objects can be viewed in a memory-mapped Repository", "[MmapByteIO]") {
+    FILE* f = tmpfile();
+    REQUIRE(f != nullptr);
+
+    const uint8_t inlineData[] = u8"Hello, World";
+    std::vector<uint8_t> streamData(1000);
+
+    for (size_t i = 0; i < streamData.size(); i++)
+        streamData[i] = (uint8_t) i;
+
+    {
+        bleb::StdioFileByteIO sbio(f, false);
+        bleb::Repository repo(&sbio);
+
+        REQUIRE(repo.open(true));
+        repo.setObjectContents("inline", inlineData, sizeof(inlineData), bleb::kPreferInlinePayload);
+        repo.setObjectContents("stream", &streamData[0], streamData.size(), 0);
+    }
+
+    fflush(f);
+
+    bleb::MmapByteIO mbio(fileno(f), false);
+    bleb::Repository repo(&mbio);
+
+    REQUIRE(repo.open(false));
+
+    const uint8_t* contents;
+    size_t size;
+
+    REQUIRE(repo.getObjectView("inline", contents, size));
+    REQUIRE(size == sizeof(inlineData));
+    REQUIRE(memcmp(contents, inlineData, size) == 0);
+
+    REQUIRE(repo.getObjectView("stream", contents, size));
+    REQUIRE(size == streamData.size());
+    REQUIRE(memcmp(contents, &streamData[0], size) == 0);
+
+    REQUIRE(!repo.getObjectView("missing", contents, size));
+
+    repo.close();
+    fclose(f);
+}
+
+TEST_CASE("WritableMmapByteIO grows as data is appended", "[WritableMmapByteIO]") {
+    FILE* f = tmpfile();
+    REQUIRE(f != nullptr);
+
+    std::vector<uint8_t> data(100000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 7);
+
+    {
+        bleb::WritableMmapByteIO wmbio(fileno(f), false, 4096);
+        REQUIRE(wmbio.isMapped());
+
+        for (size_t pos = 0; pos < data.size(); pos += 1000)
+            REQUIRE(wmbio.setBytesAt(pos, &data[pos], 1000));
+
+        REQUIRE(wmbio.clearBytesAt(data.size(), 50000));
+        REQUIRE(wmbio.getSize() == data.size() + 50000);
+
+        uint8_t readBuffer[1000];
+        REQUIRE(wmbio.getBytesAt(50000, readBuffer, sizeof(readBuffer)));
+        REQUIRE(memcmp(readBuffer, &data[50000], sizeof(readBuffer)) == 0);
+        REQUIRE(wmbio.flush());
+
+        wmbio.close();
+        REQUIRE(wmbio.isTrimmed());
+    }
+
+    // trimmed to the logical size on close
+    fseek(f, 0, SEEK_END);
+    REQUIRE((size_t) ftell(f) == data.size() + 50000);
+
+    fclose(f);
+}
+
+TEST_CASE("Repository can be built in a writable mapping", "[WritableMmapByteIO]") {
+    FILE* f = tmpfile();
+    REQUIRE(f != nullptr);
+
+    std::vector<uint8_t> streamData(10000);
+
+    for (size_t i = 0; i < streamData.size(); i++)
+        streamData[i] = (uint8_t) i;
+
+    {
+        bleb::WritableMmapByteIO wmbio(fileno(f), false);
+        bleb::Repository repo(&wmbio);
+
+        REQUIRE(repo.open(true));
+        repo.setObjectContents("inline", "Hello, World", bleb::kPreferInlinePayload);
+        repo.setObjectContents("stream", &streamData[0], streamData.size(), 0);
+    }
+
+    bleb::MmapByteIO mbio(fileno(f), false);
+    bleb::Repository repo(&mbio);
+
+    REQUIRE(repo.open(false));
+
+    const uint8_t* contents;
+    size_t size;
+
+    REQUIRE(repo.getObjectView("inline", contents, size));
+    REQUIRE(size == 12);
+    REQUIRE(memcmp(contents, "Hello, World", size) == 0);
+
+    REQUIRE(repo.getObjectView("stream", contents, size));
+    REQUIRE(size == streamData.size());
+    REQUIRE(memcmp(contents, &streamData[0], size) == 0);
+
+    repo.close();
+    fclose(f);
+}
@@ -0,0 +1,286 @@
+#include "catch.hpp"
+
+#include <bleb/byteio_posix.hpp>
+#include <bleb/repository.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_CASE("PosixFdByteIO can be written to and read from", "[PosixFdByteIO]") {
+    FILE* f = tmpfile();
+    REQUIRE(f != nullptr);
+
+    bleb::PosixFdByteIO pbio(fileno(f), false);
+
+    const uint8_t testData[] = u8"Hello, World";
+    uint8_t readBuffer[sizeof(testData)];
+
+    REQUIRE(pbio.getSize() == 0);
+    REQUIRE(pbio.setBytesAt(10, testData, sizeof(testData)) == true);
+    REQUIRE(pbio.getSize() == 10 + sizeof(testData));
+    REQUIRE(pbio.getBytesAt(10, readBuffer, sizeof(readBuffer)) == true);
+    REQUIRE(memcmp(testData, readBuffer, sizeof(testData)) == 0);
+    REQUIRE(pbio.getBytesAt(11, readBuffer, sizeof(readBuffer)) == false);
+
+    REQUIRE(pbio.clearBytesAt(0, 10000) == true);
+    REQUIRE(pbio.getSize() == 10000);
+
+    fclose(f);
+}
+
+TEST_CASE("PosixFdByteIO can be read from concurrently", "[PosixFdByteIO]") {
+    FILE* f = tmpfile();
+    REQUIRE(f != nullptr);
+
+    bleb::PosixFdByteIO pbio(fileno(f), false);
+
+    std::vector<uint8_t> data(100000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 7);
+
+    REQUIRE(pbio.setBytesAt(0, &data[0], data.size()));
+
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&pbio, &data, &failures, t]() {
+            uint8_t buffer[1000];
+
+            for (size_t pos = t * 100; pos + sizeof(buffer) <= data.size(); pos += 997) {
+                if (!pbio.getBytesAt(pos, buffer, sizeof(buffer)) || memcmp(buffer, &data[pos], sizeof(buffer)) != 0)
+                    failures++;
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    REQUIRE(failures == 0);
+
+    fclose(f);
+}
+
+TEST_CASE("PosixFdByteIO supports vectored transfers", "[PosixFdByteIO]") {
+    FILE* f = tmpfile();
+    REQUIRE(f != nullptr);
+
+    bleb::PosixFdByteIO pbio(fileno(f), false);
+
+    const uint8_t hello[] = u8"Hello, ";
+    const uint8_t world[] = u8"World";
+
+    // first two segments are contiguous, the third one isn't
+    const bleb::WriteSegment writes[] = {
+        {0, hello, 7},
+        {7, world, 5},
+        {20, world, 5},
+    };
+
+    REQUIRE(pbio.setBytesAtV(writes, 3));
+    REQUIRE(pbio.getSize() == 25);
+
+    uint8_t first[12], second[5];
+
+    const bleb::ReadSegment reads[] = {
+        {20, second, 5},
+        {0, first, 12},
+    };
+
+    REQUIRE(pbio.getBytesAtV(reads, 2));
+    REQUIRE(memcmp(first, "Hello, World", 12) == 0);
+    REQUIRE(memcmp(second, "World", 5) == 0);
+
+    uint8_t third[10];
+
+    const bleb::ReadSegment pastEnd[] = {
+        {0, first, 12},
+        {12, second, 5},
+        {17, third, 10},
+    };
+
+    REQUIRE(!pbio.getBytesAtV(pastEnd, 3));
+
+    fclose(f);
+}
+
+TEST_CASE("PosixFdByteIO clears without writing zeroes", "[PosixFdByteIO]") {
+    FILE* f = tmpfile();
+    REQUIRE(f != nullptr);
+
+    bleb::PosixFdByteIO pbio(fileno(f), false);
+
+    std::vector<uint8_t> data(256 * 1024, 0xAA);
+    REQUIRE(pbio.setBytesAt(0, &data[0], data.size()));
+
+    // extend the file past its end
+    REQUIRE(pbio.clearBytesAt(data.size() - 10, 1000010));
+    REQUIRE(pbio.getSize() == data.size() + 1000000);
+
+    // inside the file, the range stays allocated
+    REQUIRE(pbio.clearBytesAt(1000, 200000));
+
+    std::vector<uint8_t> readBuffer(pbio.getSize());
+    REQUIRE(pbio.getBytesAt(0, &readBuffer[0], readBuffer.size()));
+
+    for (size_t i = 0; i < readBuffer.size(); i++) {
+        const bool cleared = (i >= 1000 && i < 201000) || i >= data.size() - 10;
+
+        if (readBuffer[i] != (cleared ? 0x00 : 0xAA))
+            FAIL("mismatch at " << i);
+    }
+
+    fclose(f);
+}
+
+static uint64_t getAllocatedBytes(int fd) {
+    struct stat st;
+    REQUIRE(fstat(fd, &st) == 0);
+    return (uint64_t) st.st_blocks * 512;
+}
+
+TEST_CASE("Released spans are deallocated, reused ones are not", "[PosixFdByteIO]") {
+    FILE* f = tmpfile();
+    REQUIRE(f != nullptr);
+
+    bleb::PosixFdByteIO pbio(fileno(f), false);
+    bleb::Repository repo(&pbio);
+
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(1024 * 1024, 0xAA);
+    bleb::ExactFitSpanGrowthPolicy exactFit;
+
+    {
+        // two spans of 512 KiB
+        auto stream = repo.openStream("big", bleb::kStreamCreate, 0, &exactFit);
+        REQUIRE(stream->setBytesAt(0, &data[0], data.size() / 2));
+        REQUIRE(stream->setBytesAt(data.size() / 2, &data[0], data.size() / 2));
+    }
+
+    const uint64_t allocatedBefore = getAllocatedBytes(fileno(f));
+    REQUIRE(allocatedBefore >= data.size());
+
+    // releases the second span
+    repo.setObjectContents("big", &data[0], 1000, 0);
+
+    if (getAllocatedBytes(fileno(f)) > allocatedBefore - data.size() / 4)
+        WARN("the file system doesn't seem to support punching holes");
+
+    // the released region is reserved for another stream, which is going to fill it; it must be allocated again
+    // rather than left as a hole
+    {
+        auto stream = repo.openStream("other", bleb::kStreamCreate, data.size() / 2 - 1000);
+        REQUIRE(stream->setBytesAt(0, &data[0], 1000));
+    }
+
+    REQUIRE(pbio.getSize() < data.size() * 3 / 2);
+    REQUIRE(getAllocatedBytes(fileno(f)) >= allocatedBefore);
+
+    repo.close();
+    fclose(f);
+}
+
+TEST_CASE("Several threads can read through one Repository", "[PosixFdByteIO]") {
+    FILE* f = tmpfile();
+    REQUIRE(f != nullptr);
+
+    bleb::PosixFdByteIO pbio(fileno(f), false);
+    bleb::Repository repo(&pbio);
+
+    REQUIRE(repo.open(true));
+
+    // objects spread over many small spans, so that readers have to walk them
+    const int numObjects = 4;
+    std::vector<std::vector<uint8_t>> contents(numObjects);
+    bleb::ExactFitSpanGrowthPolicy exactFit;
+
+    for (int i = 0; i < numObjects; i++) {
+        const std::string name = "stream" + std::to_string(i);
+        auto stream = repo.openStream(name.c_str(), bleb::kStreamCreate, 0, &exactFit);
+
+        for (int chunk = 0; chunk < 50; chunk++) {
+            std::vector<uint8_t> data(1000 + i * 10);
+
+            for (size_t j = 0; j < data.size(); j++)
+                data[j] = (uint8_t)(i * 31 + chunk * 7 + j);
+
+            REQUIRE(stream->setBytesAt(contents[i].size(), &data[0], data.size()));
+            contents[i].insert(contents[i].end(), data.begin(), data.end());
+        }
+    }
+
+    repo.setObjectContents("inline", "Hello, World", bleb::kPreferInlinePayload);
+
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&repo, &contents, &failures, t]() {
+            for (int iteration = 0; iteration < 50; iteration++) {
+                const int i = (t + iteration) % numObjects;
+                const std::string name = "stream" + std::to_string(i);
+
+                auto stream = repo.openStream(name.c_str(), 0);
+
+                if (!stream || stream->getSize() != contents[i].size()) {
+                    failures++;
+                    continue;
+                }
+
+                // jump around, then read the rest sequentially
+                uint8_t buffer[700];
+                const size_t pos = (iteration * 4999) % (contents[i].size() - sizeof(buffer));
+
+                if (!stream->getBytesAt(pos, buffer, sizeof(buffer))
+                        || memcmp(buffer, &contents[i][pos], sizeof(buffer)) != 0)
+                    failures++;
+
+                for (size_t pos = 0; pos < contents[i].size(); pos += sizeof(buffer)) {
+                    const size_t count = std::min(sizeof(buffer), contents[i].size() - pos);
+
+                    if (!stream->getBytesAt(pos, buffer, count) || memcmp(buffer, &contents[i][pos], count) != 0)
+                        failures++;
+                }
+
+                uint8_t* inlineContents;
+                size_t length;
+                repo.getObjectContents("inline", inlineContents, length);
+
+                if (length != 12 || memcmp(inlineContents, "Hello, World", 12) != 0)
+                    failures++;
+
+                free(inlineContents);
+            }
+        });
+    }
+
+    // meanwhile, another object keeps growing
+    threads.emplace_back([&repo, &failures]() {
+        uint8_t data[300] = {};
+
+        for (int iteration = 0; iteration < 100; iteration++) {
+            auto stream = repo.openStream("log", bleb::kStreamCreate | bleb::kStreamAppend);
+
+            if (!stream || !stream->setBytesAt(stream->getSize(), data, sizeof(data)))
+                failures++;
+        }
+    });
+
+    for (auto& thread : threads)
+        thread.join();
+
+    REQUIRE(failures == 0);
+
+    auto log = repo.openStream("log", 0);
+    REQUIRE(log);
+    REQUIRE(log->getSize() == 100 * 300);
+
+    repo.close();
+    fclose(f);
+}
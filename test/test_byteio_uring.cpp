@@ -0,0 +1,193 @@
+#ifdef __linux__
+
+#include "catch.hpp"
+
+#include <bleb/byteio_uring.hpp>
+#include <bleb/repository.hpp>
+
+#include <vector>
+
+// The backend silently falls back to pread when io_uring is unavailable (old kernel, seccomp, sysctl), so the tests
+// still pass in that case, but make it known that the ring itself hasn't been exercised.
+static void checkRingUsed(const bleb::IoUringByteIO& ubio, uint64_t expectedRequests) {
+    if (ubio.hasRing())
+        REQUIRE(ubio.getNumRingRequests() == expectedRequests);
+    else
+        WARN("io_uring is not available; only the synchronous fallback has been tested");
+}
+
+TEST_CASE("IoUringByteIO completes batched asynchronous reads", "[IoUringByteIO]") {
+    FILE* f = tmpfile();
+    REQUIRE(f != nullptr);
+
+    bleb::IoUringByteIO ubio(fileno(f), false, 4);
+
+    std::vector<uint8_t> data(100000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 7);
+
+    REQUIRE(ubio.setBytesAt(0, &data[0], data.size()));
+
+    // more requests than the queue depth, so that the ring has to be drained in between
+    std::vector<uint8_t> readBuffer(data.size());
+    int succeeded = 0, failed = 0;
+
+    for (size_t pos = 0; pos < data.size(); pos += 10000) {
+        REQUIRE(ubio.getBytesAtAsync(pos, &readBuffer[pos], 10000, [&](bool success) {
+            if (success)
+                succeeded++;
+            else
+                failed++;
+        }));
+    }
+
+    // past the end of file
+    REQUIRE(ubio.getBytesAtAsync(data.size() - 10, &readBuffer[0], 20, [&](bool success) {
+        if (success)
+            succeeded++;
+        else
+            failed++;
+    }));
+
+    REQUIRE(ubio.waitForCompletion());
+    REQUIRE(succeeded == 10);
+    REQUIRE(failed == 1);
+    REQUIRE(memcmp(&readBuffer[10], &data[10], data.size() - 10) == 0);
+    checkRingUsed(ubio, 11);
+
+    ubio.close();
+    fclose(f);
+}
+
+TEST_CASE("IoUringByteIO submits vectored writes as a batch", "[IoUringByteIO]") {
+    FILE* f = tmpfile();
+    REQUIRE(f != nullptr);
+
+    bleb::IoUringByteIO ubio(fileno(f), false, 2);
+
+    std::vector<uint8_t> data(10000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 7);
+
+    std::vector<bleb::WriteSegment> writes;
+
+    for (size_t pos = 0; pos < data.size(); pos += 1000)
+        writes.push_back(bleb::WriteSegment {pos, &data[pos], 1000});
+
+    REQUIRE(ubio.setBytesAtV(&writes[0], writes.size()));
+    REQUIRE(ubio.getSize() == data.size());
+    checkRingUsed(ubio, writes.size());
+
+    std::vector<uint8_t> readBuffer(data.size());
+    std::vector<bleb::ReadSegment> reads;
+
+    for (size_t pos = 0; pos < data.size(); pos += 2500)
+        reads.push_back(bleb::ReadSegment {pos, &readBuffer[pos], 2500});
+
+    REQUIRE(ubio.getBytesAtV(&reads[0], reads.size()));
+    REQUIRE(readBuffer == data);
+    checkRingUsed(ubio, writes.size() + reads.size());
+
+    ubio.close();
+    fclose(f);
+}
+
+TEST_CASE("Multi-span stream can be read through IoUringByteIO", "[IoUringByteIO]") {
+    FILE* f = tmpfile();
+    REQUIRE(f != nullptr);
+
+    bleb::IoUringByteIO ubio(fileno(f), false);
+    bleb::Repository repo(&ubio);
+
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(20000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 13);
+
+    {
+        auto stream = repo.openStream("stream", bleb::kStreamCreate);
+        REQUIRE(stream != nullptr);
+
+        for (size_t pos = 0; pos < data.size(); pos += 1000)
+            REQUIRE(stream->setBytesAt(pos, &data[pos], 1000));
+    }
+
+    uint8_t* contents = nullptr;
+    size_t size;
+    repo.getObjectContents("stream", contents, size);
+    REQUIRE(contents != nullptr);
+
+    REQUIRE(size == data.size());
+    REQUIRE(memcmp(contents, &data[0], size) == 0);
+    free(contents);
+
+    if (ubio.hasRing())
+        REQUIRE(ubio.getNumRingRequests() > 0);
+    else
+        WARN("io_uring is not available; only the synchronous fallback has been tested");
+
+    repo.close();
+    fclose(f);
+}
+
+TEST_CASE("Reading a fragmented stream through IoUringByteIO takes a single submission", "[IoUringByteIO]") {
+    FILE* f = tmpfile();
+    REQUIRE(f != nullptr);
+
+    bleb::IoUringByteIO ubio(fileno(f), false);
+    bleb::Repository repo(&ubio);
+
+    repo.setReadAheadSize(0);
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(20000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 13);
+
+    {
+        // interleaving with another stream makes sure no two spans are adjacent in the file
+        auto stream = repo.openStream("stream", bleb::kStreamCreate);
+        auto other = repo.openStream("other", bleb::kStreamCreate);
+
+        for (size_t pos = 0; pos < data.size(); pos += 1000) {
+            REQUIRE(stream->setBytesAt(pos, &data[pos], 1000));
+            REQUIRE(other->setBytesAt(pos, &data[pos], 1000));
+        }
+    }
+
+    std::vector<bleb::ObjectExtent> extents;
+    REQUIRE(repo.getObjectExtents("stream", extents));
+    REQUIRE(extents.size() > 4);
+
+    auto stream = repo.openStream("stream", 0);
+    REQUIRE(stream != nullptr);
+
+    // walk the chain first, so that the read itself doesn't need any span headers
+    uint8_t byte;
+    REQUIRE(stream->getBytesAt(data.size() - 1, &byte, 1));
+
+    const uint64_t requestsBefore = ubio.getNumRingRequests();
+    const uint64_t submissionsBefore = ubio.getNumSubmissions();
+
+    std::vector<uint8_t> readBuffer(data.size());
+    REQUIRE(stream->getBytesAt(0, &readBuffer[0], readBuffer.size()));
+    REQUIRE(readBuffer == data);
+
+    if (ubio.hasRing()) {
+        REQUIRE(ubio.getNumRingRequests() - requestsBefore == extents.size());
+        REQUIRE(ubio.getNumSubmissions() - submissionsBefore == 1);
+    }
+    else
+        WARN("io_uring is not available; only the synchronous fallback has been tested");
+
+    stream.reset();
+    repo.close();
+    fclose(f);
+}
+
+#endif
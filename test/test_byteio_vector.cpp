@@ -29,6 +29,28 @@ TEST_CASE("VectorByteIO can be filled up to the brim", "[VectorByteIO]") {
     REQUIRE(vbio.clearBytesAt(0, 5) == true);
 }
 
+TEST_CASE("VectorByteIO supports vectored transfers", "[VectorByteIO]") {
+    bleb::VectorByteIO vbio(100, true);
+
+    const uint8_t testData[] = u8"Hello, World";
+    uint8_t first[5], second[5];
+
+    const bleb::WriteSegment writes[] = {
+        {10, testData + 7, 5},
+        {0, testData, 5},
+    };
+
+    const bleb::ReadSegment reads[] = {
+        {0, first, 5},
+        {10, second, 5},
+    };
+
+    REQUIRE(vbio.setBytesAtV(writes, 2) == true);
+    REQUIRE(vbio.getBytesAtV(reads, 2) == true);
+    REQUIRE(memcmp(first, "Hello", 5) == 0);
+    REQUIRE(memcmp(second, "World", 5) == 0);
+}
+
 /*TEST_CASE("Repository can be initialized") {
     bleb::VectorByteIO vbio(300, false);
 }*/
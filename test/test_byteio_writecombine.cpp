@@ -0,0 +1,122 @@
+#include "catch.hpp"
+#include "counting_byteio.hpp"
+
+#include <bleb/byteio_vector.hpp>
+#include <bleb/byteio_writecombine.hpp>
+#include <bleb/repository.hpp>
+
+#include <vector>
+
+TEST_CASE("WriteCombiningByteIO merges adjacent and overlapping writes", "[WriteCombiningByteIO]") {
+    CountingByteIO backend;
+    bleb::WriteCombiningByteIO wcbio(&backend);
+
+    const uint8_t testData[] = u8"Hello, World";
+    uint8_t readBuffer[sizeof(testData)];
+
+    // written out of order and with an overlap; should end up as a single range
+    REQUIRE(wcbio.setBytesAt(7, testData + 7, 6));
+    REQUIRE(wcbio.setBytesAt(0, testData, 5));
+    REQUIRE(wcbio.setBytesAt(4, testData + 4, 4));
+    REQUIRE(wcbio.getBufferedBytes() == sizeof(testData));
+
+    // a separate range with a gap in between
+    REQUIRE(wcbio.setBytesAt(20, testData, 5));
+    REQUIRE(wcbio.getSize() == 25);
+
+    REQUIRE(wcbio.getBytesAt(0, readBuffer, sizeof(readBuffer)));
+    REQUIRE(memcmp(readBuffer, testData, sizeof(testData)) == 0);
+    REQUIRE(backend.writes == 0);
+
+    REQUIRE(wcbio.flush());
+    REQUIRE(backend.writes == 2);
+    REQUIRE(backend.getSize() == 25);
+
+    REQUIRE(backend.getBytesAt(0, readBuffer, sizeof(readBuffer)));
+    REQUIRE(memcmp(readBuffer, testData, sizeof(testData)) == 0);
+}
+
+TEST_CASE("WriteCombiningByteIO reads see buffered data on top of the backend", "[WriteCombiningByteIO]") {
+    CountingByteIO backend;
+
+    const uint8_t testData[] = u8"Hello, World";
+    uint8_t readBuffer[sizeof(testData)];
+
+    REQUIRE(backend.setBytesAt(0, testData, sizeof(testData)));
+
+    bleb::WriteCombiningByteIO wcbio(&backend);
+    REQUIRE(wcbio.clearBytesAt(2, 3));
+    REQUIRE(wcbio.setBytesAt(sizeof(testData) + 2, testData, 1));
+
+    REQUIRE(wcbio.getBytesAt(0, readBuffer, sizeof(readBuffer)));
+    REQUIRE(memcmp(readBuffer, "He\0\0\0, World", sizeof(testData)) == 0);
+
+    // the gap past the backend's end of file reads as zeroes
+    REQUIRE(wcbio.getBytesAt(sizeof(testData), readBuffer, 3));
+    REQUIRE(memcmp(readBuffer, "\0\0H", 3) == 0);
+}
+
+TEST_CASE("Repository can be built through WriteCombiningByteIO", "[WriteCombiningByteIO]") {
+    CountingByteIO backend;
+    std::vector<uint8_t> data(5000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t) i;
+
+    {
+        bleb::WriteCombiningByteIO wcbio(&backend);
+        bleb::Repository repo(&wcbio);
+
+        REQUIRE(repo.open(true));
+
+        auto stream = repo.openStream("stream", bleb::kStreamCreate);
+        REQUIRE(stream != nullptr);
+
+        for (size_t pos = 0; pos < data.size(); pos += 100)
+            REQUIRE(stream->setBytesAt(pos, &data[pos], 100));
+
+        stream.reset();
+        repo.close();
+    }
+
+    REQUIRE(backend.writes < 10);
+
+    bleb::Repository repo(&backend);
+    REQUIRE(repo.open(false));
+
+    uint8_t* contents = nullptr;
+    size_t size;
+    repo.getObjectContents("stream", contents, size);
+    REQUIRE(contents != nullptr);
+
+    REQUIRE(size == data.size());
+    REQUIRE(memcmp(contents, &data[0], size) == 0);
+    free(contents);
+}
+
+TEST_CASE("WriteCombiningByteIO keeps data the backend failed to write", "[WriteCombiningByteIO]") {
+    CountingByteIO backend;
+    bleb::WriteCombiningByteIO wcbio(&backend);
+
+    const uint8_t testData[] = u8"Hello, World";
+    uint8_t readBuffer[sizeof(testData)];
+
+    REQUIRE(wcbio.setBytesAt(0, testData, sizeof(testData)));
+    REQUIRE(wcbio.setBytesAt(100, testData, sizeof(testData)));
+
+    backend.failWrites = true;
+    REQUIRE(!wcbio.flush());
+    REQUIRE(wcbio.getBufferedBytes() == 2 * sizeof(testData));
+
+    // still readable, and written out by the next flush
+    REQUIRE(wcbio.getBytesAt(100, readBuffer, sizeof(readBuffer)));
+    REQUIRE(memcmp(readBuffer, testData, sizeof(testData)) == 0);
+
+    backend.failWrites = false;
+    REQUIRE(wcbio.flush());
+    REQUIRE(wcbio.getBufferedBytes() == 0);
+    REQUIRE(backend.writes == 2);
+
+    REQUIRE(backend.getBytesAt(100, readBuffer, sizeof(readBuffer)));
+    REQUIRE(memcmp(readBuffer, testData, sizeof(testData)) == 0);
+}
@@ -1,8 +1,13 @@
 #include "catch.hpp"
+#include "counting_byteio.hpp"
 
 #include <bleb/byteio_vector.hpp>
 #include <bleb/repository.hpp>
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 TEST_CASE("Repository can be initialized") {
     bleb::VectorByteIO vbio(1000, false);
     bleb::Repository repo(&vbio);
@@ -14,9 +19,9 @@ TEST_CASE("Repository can be initialized") {
 }
 
 TEST_CASE("Repository Content Directory Stream initialization fails gracefully") {
-    // Size large enough to fit repository header, but too small for the initial stream allocation
-    // => 16 (RepositoryPrologue_t::SIZE) + 16 (StreamDescriptor_t::SIZE) = 32
-    bleb::VectorByteIO vbio(32, false);
+    // Size large enough to fit repository header, but too small for the Content Directory's first span
+    // => 16 (RepositoryPrologue_t::SIZE) + 2 * 16 (StreamDescriptor_t::SIZE) = 48
+    bleb::VectorByteIO vbio(48, false);
     bleb::Repository repo(&vbio);
 
     REQUIRE(!repo.open(true));
@@ -42,3 +47,1184 @@ TEST_CASE("Object can be stored and retrieved") {
     REQUIRE(memcmp(contents, testData, size) == 0);
     free(contents);
 }
+
+TEST_CASE("Fragmented stream supports random access", "[RepositoryStream]") {
+    bleb::VectorByteIO vbio(0, true);
+    bleb::Repository repo(&vbio);
+
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(50000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 13 + i / 256);
+
+    {
+        // interleaving appends to two streams makes both of them a chain of many spans
+        auto stream = repo.openStream("stream", bleb::kStreamCreate);
+        auto other = repo.openStream("other", bleb::kStreamCreate);
+
+        for (size_t pos = 0; pos < data.size(); pos += 100) {
+            REQUIRE(stream->setBytesAt(pos, &data[pos], 100));
+            REQUIRE(other->setBytesAt(pos, &data[pos], 100));
+        }
+    }
+
+    // a fresh stream, so that the spans are discovered while seeking
+    auto stream = repo.openStream("stream", 0);
+    REQUIRE(stream->getSize() == data.size());
+
+    uint8_t buffer[300];
+
+    for (size_t i = 0; i < 1000; i++) {
+        // jump back and forth across the whole stream
+        const size_t pos = (i % 2 == 0) ? (i * 7919) % (data.size() - sizeof(buffer))
+                : data.size() - sizeof(buffer) - (i * 104729) % (data.size() - sizeof(buffer));
+
+        REQUIRE(stream->getBytesAt(pos, buffer, sizeof(buffer)));
+        REQUIRE(memcmp(buffer, &data[pos], sizeof(buffer)) == 0);
+    }
+
+    // overwrite in the middle after seeking, then read everything back in one go
+    REQUIRE(stream->setBytesAt(20000, &data[0], 5000));
+    memcpy(&data[20000], &data[0], 5000);
+
+    std::vector<uint8_t> readBack(data.size());
+    REQUIRE(stream->getBytesAt(0, &readBack[0], readBack.size()));
+    REQUIRE(readBack == data);
+
+    // appending after a seek
+    REQUIRE(stream->setBytesAt(data.size(), &data[0], 1000));
+    REQUIRE(stream->getSize() == data.size() + 1000);
+    REQUIRE(stream->getBytesAt(data.size() + 500, buffer, 100));
+    REQUIRE(memcmp(buffer, &data[500], 100) == 0);
+}
+
+TEST_CASE("Span headers can be written back lazily", "[RepositoryStream]") {
+    CountingByteIO cbio;
+    bleb::Repository repo(&cbio);
+
+    repo.setMetadataWriteBack(true);
+    REQUIRE(repo.open(true));
+
+    auto stream = repo.openStream("stream", bleb::kStreamCreate);
+
+    const uint8_t testData[] = u8"0123456789";
+    const int numAppends = 1000;
+
+    // warm up, so that the stream has space reserved
+    REQUIRE(stream->setBytesAt(0, testData, 10));
+    REQUIRE(stream->setBytesAt(10, testData, 10));
+
+    const int writesBefore = cbio.writes;
+
+    for (int i = 2; i < numAppends; i++)
+        REQUIRE(stream->setBytesAt(i * 10, testData, 10));
+
+    // one write per append for the data; the occasional new span adds a few more
+    REQUIRE(cbio.writes - writesBefore < (numAppends - 2) * 11 / 10);
+
+    // nothing of the stream is visible on disk yet
+    {
+        bleb::VectorByteIO snapshot(0, true);
+        cbio.snapshotTo(snapshot);
+
+        bleb::Repository repo2(&snapshot);
+        REQUIRE(repo2.open(false));
+
+        uint8_t* contents = nullptr;
+        size_t size = 0;
+        repo2.getObjectContents("stream", contents, size);
+        REQUIRE(size == 0);
+        free(contents);
+    }
+
+    REQUIRE(stream->flush());
+
+    {
+        bleb::VectorByteIO snapshot(0, true);
+        cbio.snapshotTo(snapshot);
+
+        bleb::Repository repo2(&snapshot);
+        REQUIRE(repo2.open(false));
+
+        uint8_t* contents = nullptr;
+        size_t size;
+        repo2.getObjectContents("stream", contents, size);
+        REQUIRE(contents != nullptr);
+        REQUIRE(size == numAppends * 10);
+
+        for (int i = 0; i < numAppends; i++)
+            REQUIRE(memcmp(contents + i * 10, testData, 10) == 0);
+
+        free(contents);
+    }
+
+    stream.reset();
+    REQUIRE(repo.flush());
+}
+
+TEST_CASE("Span headers stay dirty when writing them back fails", "[RepositoryStream]") {
+    CountingByteIO cbio;
+    bleb::Repository repo(&cbio);
+
+    repo.setMetadataWriteBack(true);
+    REQUIRE(repo.open(true));
+
+    auto stream = repo.openStream("stream", bleb::kStreamCreate);
+
+    const uint8_t testData[] = u8"0123456789";
+    const int numAppends = 1000;
+
+    for (int i = 0; i < numAppends; i++)
+        REQUIRE(stream->setBytesAt(i * 10, testData, 10));
+
+    cbio.failWrites = true;
+    REQUIRE(!stream->flush());
+
+    // the retry must still write out every header
+    cbio.failWrites = false;
+    REQUIRE(stream->flush());
+
+    bleb::VectorByteIO snapshot(0, true);
+    cbio.snapshotTo(snapshot);
+
+    bleb::Repository repo2(&snapshot);
+    REQUIRE(repo2.open(false));
+
+    uint8_t* contents = nullptr;
+    size_t size;
+    repo2.getObjectContents("stream", contents, size);
+    REQUIRE(contents != nullptr);
+    REQUIRE(size == numAppends * 10);
+
+    for (int i = 0; i < numAppends; i++)
+        REQUIRE(memcmp(contents + i * 10, testData, 10) == 0);
+
+    free(contents);
+
+    stream.reset();
+    REQUIRE(repo.flush());
+}
+
+TEST_CASE("Failed stream writes leave the stream as it was", "[RepositoryStream]") {
+    CountingByteIO cbio;
+    bleb::Repository repo(&cbio);
+
+    SECTION("write-through") {
+        repo.setMetadataWriteBack(false);
+    }
+
+    SECTION("write-back") {
+        repo.setMetadataWriteBack(true);
+    }
+
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(10000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 11);
+
+    const uint64_t freeSpaceBefore = repo.getFreeSpaceLength();
+
+    {
+        auto stream = repo.openStream("stream", bleb::kStreamCreate);
+        REQUIRE(stream->setBytesAt(0, &data[0], 1000));
+        REQUIRE(stream->flush());
+
+        // the span has room for this, so only the batched write fails
+        cbio.failVectoredWrites = true;
+        REQUIRE(!stream->setBytesAt(1000, &data[1000], 10));
+        REQUIRE(stream->getSize() == 1000);
+
+        // this one needs new spans, which get allocated and then released again
+        REQUIRE(!stream->setBytesAt(1000, &data[1000], 9000));
+        REQUIRE(stream->getSize() == 1000);
+        REQUIRE(repo.getFreeSpaceLength() > freeSpaceBefore);
+        cbio.failVectoredWrites = false;
+
+        // and the stream can still be read and written
+        std::vector<uint8_t> readBuffer(1000);
+        REQUIRE(stream->getBytesAt(0, &readBuffer[0], readBuffer.size()));
+        REQUIRE(memcmp(&readBuffer[0], &data[0], readBuffer.size()) == 0);
+        REQUIRE(!stream->getBytesAt(500, &readBuffer[0], readBuffer.size()));
+
+        REQUIRE(stream->setBytesAt(1000, &data[1000], 1000));
+    }
+
+    bleb::VectorByteIO snapshot(0, true);
+    cbio.snapshotTo(snapshot);
+
+    bleb::Repository repo2(&snapshot);
+    REQUIRE(repo2.open(false));
+
+    uint8_t* contents = nullptr;
+    size_t size;
+    repo2.getObjectContents("stream", contents, size);
+    REQUIRE(contents != nullptr);
+    REQUIRE(size == 2000);
+    REQUIRE(memcmp(contents, &data[0], size) == 0);
+    free(contents);
+}
+
+TEST_CASE("Stream ranges can be cleared in bulk", "[RepositoryStream]") {
+    CountingByteIO cbio;
+    bleb::Repository repo(&cbio);
+
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(100000, 0xAA);
+
+    auto stream = repo.openStream("stream", bleb::kStreamCreate);
+
+    for (size_t pos = 0; pos < data.size(); pos += 1000)
+        REQUIRE(stream->setBytesAt(pos, &data[pos], 1000));
+
+    // clear across many spans
+    const int writesBefore = cbio.writes;
+    REQUIRE(stream->clearBytesAt(12345, 50000));
+    REQUIRE(cbio.writes - writesBefore < 10);
+    std::fill(data.begin() + 12345, data.begin() + 12345 + 50000, 0);
+
+    // extend the stream with zeroes
+    REQUIRE(stream->clearBytesAt(data.size() - 10, 1000010));
+    data.resize(data.size() + 1000000);
+    std::fill(data.end() - 1000010, data.end(), 0);
+    REQUIRE(stream->getSize() == data.size());
+
+    std::vector<uint8_t> readBack(data.size());
+    REQUIRE(stream->getBytesAt(0, &readBack[0], readBack.size()));
+    REQUIRE(readBack == data);
+}
+
+TEST_CASE("Fragmented stream can be defragmented", "[Repository]") {
+    bleb::VectorByteIO vbio(0, true);
+    bleb::Repository repo(&vbio);
+
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(30000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 31);
+
+    auto writeInterleaved = [&](const char* name1, const char* name2) {
+        auto stream1 = repo.openStream(name1, bleb::kStreamCreate);
+        auto stream2 = repo.openStream(name2, bleb::kStreamCreate);
+
+        for (size_t pos = 0; pos < data.size(); pos += 500) {
+            REQUIRE(stream1->setBytesAt(pos, &data[pos], 500));
+            REQUIRE(stream2->setBytesAt(pos, &data[pos], 500));
+        }
+    };
+
+    writeInterleaved("stream1", "stream2");
+
+    const uint8_t* view;
+    size_t size;
+
+    // only a single-span stream can be viewed directly
+    REQUIRE(!repo.getObjectView("stream1", view, size));
+
+    const uint64_t freeSpaceBefore = repo.getFreeSpaceLength();
+
+    REQUIRE(repo.defragmentObject("stream1"));
+    REQUIRE(repo.getObjectView("stream1", view, size));
+    REQUIRE(size == data.size());
+    REQUIRE(memcmp(view, &data[0], size) == 0);
+
+    // the old spans must be released, not leaked
+    REQUIRE(repo.getFreeSpaceLength() >= freeSpaceBefore + data.size());
+
+    // nothing to do the second time
+    REQUIRE(repo.defragmentObject("stream1"));
+
+    // together with stream2's old spans, stream1's form a hole big enough for a copy of either
+    REQUIRE(repo.defragmentObject("stream2"));
+    const uint64_t sizeBefore = vbio.getSize();
+    repo.setObjectContents("stream5", &data[0], data.size(), 0);
+    REQUIRE(vbio.getSize() == sizeBefore);
+
+    REQUIRE(!repo.defragmentObject("missing"));
+
+    // now automatically on close
+    repo.setDefragmentationThreshold(4);
+    writeInterleaved("stream3", "stream4");
+
+    REQUIRE(repo.getObjectView("stream3", view, size));
+    REQUIRE(size == data.size());
+    REQUIRE(memcmp(view, &data[0], size) == 0);
+
+    uint8_t* contents = nullptr;
+    repo.getObjectContents("stream4", contents, size);
+    REQUIRE(contents != nullptr);
+    REQUIRE(size == data.size());
+    REQUIRE(memcmp(contents, &data[0], size) == 0);
+    free(contents);
+}
+
+TEST_CASE("Truncated streams release their spans for reuse", "[Repository]") {
+    bleb::VectorByteIO vbio(0, true);
+    bleb::Repository repo(&vbio);
+
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(20000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 3);
+
+    auto rewrite = [&](const char* name) {
+        auto stream = repo.openStream(name, bleb::kStreamCreate | bleb::kStreamTruncate);
+        REQUIRE(stream->getSize() == 0);
+
+        for (size_t pos = 0; pos < data.size(); pos += 1000)
+            REQUIRE(stream->setBytesAt(pos, &data[pos], 1000));
+    };
+
+    rewrite("stream");
+    rewrite("stream");
+    const uint64_t sizeAfterTwoRewrites = vbio.getSize();
+
+    for (int i = 0; i < 20; i++)
+        rewrite("stream");
+
+    // all spans but the first one get recycled every time
+    REQUIRE(vbio.getSize() == sizeAfterTwoRewrites);
+
+    uint8_t* contents = nullptr;
+    size_t size;
+    repo.getObjectContents("stream", contents, size);
+    REQUIRE(contents != nullptr);
+    REQUIRE(size == data.size());
+    REQUIRE(memcmp(contents, &data[0], size) == 0);
+    free(contents);
+
+    // shrink in the middle of the chain, then grow again
+    repo.setObjectContents("stream", &data[0], 5000, 0);
+    repo.getObjectContents("stream", contents, size);
+    REQUIRE(contents != nullptr);
+    REQUIRE(size == 5000);
+    REQUIRE(memcmp(contents, &data[0], size) == 0);
+    free(contents);
+
+    repo.setObjectContents("stream", &data[0], data.size(), 0);
+    repo.getObjectContents("stream", contents, size);
+    REQUIRE(contents != nullptr);
+    REQUIRE(size == data.size());
+    REQUIRE(memcmp(contents, &data[0], size) == 0);
+    free(contents);
+}
+
+TEST_CASE("Free space is remembered across reopening", "[Repository]") {
+    bleb::VectorByteIO vbio(0, true);
+
+    std::vector<uint8_t> data(20000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 5);
+
+    uint64_t freeSpaceLength;
+
+    {
+        bleb::Repository repo(&vbio);
+        REQUIRE(repo.open(true));
+
+        auto stream = repo.openStream("stream", bleb::kStreamCreate);
+
+        for (size_t pos = 0; pos < data.size(); pos += 1000)
+            REQUIRE(stream->setBytesAt(pos, &data[pos], 1000));
+
+        stream.reset();
+
+        // keep the first span only
+        repo.setObjectContents("stream", &data[0], 100, 0);
+
+        freeSpaceLength = repo.getFreeSpaceLength();
+        REQUIRE(freeSpaceLength >= data.size() - 1000);
+    }
+
+    const uint64_t sizeBeforeReopen = vbio.getSize();
+
+    {
+        bleb::Repository repo(&vbio);
+        REQUIRE(repo.open(false));
+
+        // the spans released earlier were adjacent, so they can take a single bigger span
+        REQUIRE(repo.getFreeSpaceLength() == freeSpaceLength);
+
+        repo.setObjectContents("other", &data[0], 10000, 0);
+        REQUIRE(repo.getFreeSpaceLength() < freeSpaceLength);
+
+        std::vector<bleb::ObjectExtent> extents;
+        REQUIRE(repo.getObjectExtents("other", extents));
+        REQUIRE(extents.size() == 1);
+    }
+
+    REQUIRE(vbio.getSize() == sizeBeforeReopen);
+
+    {
+        bleb::Repository repo(&vbio);
+        REQUIRE(repo.open(false));
+
+        uint8_t* contents = nullptr;
+        size_t size;
+        repo.getObjectContents("other", contents, size);
+        REQUIRE(contents != nullptr);
+        REQUIRE(size == 10000);
+        REQUIRE(memcmp(contents, &data[0], size) == 0);
+        free(contents);
+
+        repo.getObjectContents("stream", contents, size);
+        REQUIRE(contents != nullptr);
+        REQUIRE(size == 100);
+        REQUIRE(memcmp(contents, &data[0], size) == 0);
+        free(contents);
+    }
+}
+
+static uint64_t getLE64(bleb::ByteIO& io, uint64_t pos) {
+    uint8_t bytes[8];
+    REQUIRE(io.getBytesAt(pos, bytes, sizeof(bytes)));
+
+    uint64_t value = 0;
+
+    for (int i = 7; i >= 0; i--)
+        value = (value << 8) | bytes[i];
+
+    return value;
+}
+
+static void setLE64(bleb::ByteIO& io, uint64_t pos, uint64_t value) {
+    uint8_t bytes[8];
+
+    for (int i = 0; i < 8; i++)
+        bytes[i] = (uint8_t)(value >> (i * 8));
+
+    REQUIRE(io.setBytesAt(pos, bytes, sizeof(bytes)));
+}
+
+TEST_CASE("Corrupted free space list is rejected", "[Repository]") {
+    bleb::VectorByteIO vbio(0, true);
+
+    std::vector<uint8_t> data(20000);
+
+    {
+        bleb::Repository repo(&vbio);
+        REQUIRE(repo.open(true));
+
+        // interleave two streams, then truncate one of them, so that there is more than one free extent
+        {
+            auto a = repo.openStream("a", bleb::kStreamCreate);
+            auto b = repo.openStream("b", bleb::kStreamCreate);
+
+            for (size_t pos = 0; pos < data.size(); pos += 1000) {
+                REQUIRE(a->setBytesAt(pos, &data[pos], 1000));
+                REQUIRE(b->setBytesAt(pos, &data[pos], 1000));
+            }
+        }
+
+        repo.setObjectContents("a", &data[0], 100, 0);
+        REQUIRE(repo.getFreeSpaceLength() > 0);
+    }
+
+    // Free Space stream descriptor follows the prologue and the Content Directory descriptor; the list starts with
+    // the extent count, followed by (location, length) pairs
+    const uint64_t listPos = getLE64(vbio, 16 + 16) + 16;
+    const uint64_t count = getLE64(vbio, listPos);
+    REQUIRE(count >= 2);
+
+    const uint64_t firstExtentPos = listPos + 8;
+    const uint64_t secondExtentPos = firstExtentPos + 16;
+
+    SECTION("overlapping extents") {
+        setLE64(vbio, secondExtentPos, getLE64(vbio, firstExtentPos));
+    }
+
+    SECTION("empty extent") {
+        setLE64(vbio, firstExtentPos + 8, 0);
+    }
+
+    SECTION("extent past the end of file") {
+        setLE64(vbio, secondExtentPos + 8, vbio.getSize());
+    }
+
+    SECTION("extent covering the repository header") {
+        setLE64(vbio, firstExtentPos, 0);
+    }
+
+    bleb::Repository repo(&vbio);
+    REQUIRE(!repo.open(false));
+    REQUIRE(repo.getErrorKind() == bleb::errRepositoryCorruption);
+}
+
+TEST_CASE("Free space stream isn't defragmented behind its own back", "[Repository]") {
+    bleb::VectorByteIO vbio(0, true);
+
+    std::vector<uint8_t> data(4000);
+    uint64_t freeSpaceStreamLocation = 0;
+
+    // each session leaves behind free extents too small for the next one, so the list outgrows the span reserved
+    // for it
+    for (int session = 0; session < 4; session++) {
+        bleb::Repository repo(&vbio);
+        REQUIRE(repo.open(session == 0));
+
+        const std::string a = "a" + std::to_string(session), b = "b" + std::to_string(session);
+        const size_t chunkLength = 500 << session;
+
+        {
+            auto streamA = repo.openStream(a.c_str(), bleb::kStreamCreate);
+            auto streamB = repo.openStream(b.c_str(), bleb::kStreamCreate);
+
+            for (int i = 0; i < 20; i++) {
+                REQUIRE(streamA->setBytesAt(streamA->getSize(), &data[0], chunkLength));
+                REQUIRE(streamB->setBytesAt(streamB->getSize(), &data[0], chunkLength));
+            }
+        }
+
+        repo.setObjectContents(a.c_str(), &data[0], 10, 0);
+
+        if (session > 0)
+            freeSpaceStreamLocation = getLE64(vbio, 16 + 16);
+
+        repo.setDefragmentationThreshold(1);
+    }
+
+    // the stream has grown a span at the end of the file, but still starts where it did
+    REQUIRE(freeSpaceStreamLocation != 0);
+    REQUIRE(getLE64(vbio, 16 + 16) == freeSpaceStreamLocation);
+}
+
+TEST_CASE("Small spans are packed together when pooled", "[Repository]") {
+    bleb::VectorByteIO vbio(0, true);
+
+    std::vector<uint8_t> data(100);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 7);
+
+    {
+        bleb::Repository repo(&vbio);
+        repo.setSmallSpanPooling(true);
+        REQUIRE(repo.open(true));
+
+        char name[20];
+        uint64_t minLocation = UINT64_MAX, maxLocation = 0;
+
+        for (int i = 0; i < 10; i++) {
+            snprintf(name, sizeof(name), "small%d", i);
+            repo.setObjectContents(name, &data[0], data.size(), 0);
+
+            std::vector<bleb::ObjectExtent> extents;
+            REQUIRE(repo.getObjectExtents(name, extents));
+            REQUIRE(extents.size() == 1);
+
+            minLocation = std::min(minLocation, extents[0].location);
+            maxLocation = std::max(maxLocation, extents[0].location);
+        }
+
+        // 100 bytes + span header => 128-byte slots, one after another
+        REQUIRE(maxLocation - minLocation == 9 * 128);
+
+        uint8_t* contents = nullptr;
+        size_t size;
+        repo.getObjectContents("small5", contents, size);
+        REQUIRE(contents != nullptr);
+        REQUIRE(size == data.size());
+        REQUIRE(memcmp(contents, &data[0], size) == 0);
+        free(contents);
+    }
+
+    // the rest of the region is up for grabs
+    bleb::Repository repo(&vbio);
+    REQUIRE(repo.open(false));
+    REQUIRE(repo.getFreeSpaceLength() >= 6 * 128);
+}
+
+TEST_CASE("Metadata is kept in a hot region at the start of the file", "[Repository]") {
+    CountingByteIO cbio;
+
+    {
+        bleb::Repository repo(&cbio);
+        repo.setExpectedRepositorySize(1024 * 1024);
+        REQUIRE(repo.open(true));
+
+        char name[20];
+
+        for (int i = 0; i < 50; i++) {
+            snprintf(name, sizeof(name), "meta%d", i);
+            repo.setObjectContents(name, "some metadata", bleb::kPreferInlinePayload);
+        }
+
+        std::vector<uint8_t> data(10000);
+        repo.setObjectContents("payload", &data[0], data.size(), 0);
+
+        std::vector<bleb::ObjectExtent> extents;
+        REQUIRE(repo.getObjectExtents("payload", extents));
+        REQUIRE(extents[0].location >= 4096);
+    }
+
+    // looking up metadata doesn't have to go past the first page (read-ahead would just read whatever follows)
+    cbio.maxReadEnd = 0;
+
+    bleb::Repository repo(&cbio);
+    repo.setReadAheadSize(0);
+    REQUIRE(repo.open(false));
+
+    uint8_t* contents = nullptr;
+    size_t size;
+    repo.getObjectContents("meta49", contents, size);
+    REQUIRE(contents != nullptr);
+    REQUIRE(size == 13);
+    REQUIRE(memcmp(contents, "some metadata", size) == 0);
+    free(contents);
+
+    REQUIRE(cbio.maxReadEnd <= 4096);
+}
+
+TEST_CASE("Repository can be compacted into a new file", "[Repository]") {
+    bleb::VectorByteIO vbio(0, true);
+    bleb::Repository repo(&vbio);
+
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(30000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 11);
+
+    // fragmented streams
+    for (const char* name : {"first", "second"}) {
+        auto stream = repo.openStream(name, bleb::kStreamCreate);
+
+        for (size_t pos = 0; pos < data.size(); pos += 500)
+            REQUIRE(stream->setBytesAt(pos, &data[pos], 500));
+    }
+
+    // dead space
+    repo.setObjectContents("first", &data[0], 1000, 0);
+    repo.setObjectContents("inline", "short", bleb::kPreferInlinePayload);
+    repo.setObjectContents("inline", "a bit longer than before", bleb::kPreferInlinePayload);
+    repo.setObjectContents("empty", "", 0);
+
+    bleb::VectorByteIO compactedIO(0, true);
+    REQUIRE(repo.compactTo(&compactedIO));
+    REQUIRE(compactedIO.getSize() < vbio.getSize());
+
+    bleb::Repository compacted(&compactedIO);
+    REQUIRE(compacted.open(false));
+
+    std::vector<std::string> names, compactedNames;
+
+    for (auto name : repo)
+        names.push_back(name);
+
+    for (auto name : compacted)
+        compactedNames.push_back(name);
+
+    REQUIRE(names == compactedNames);
+
+    for (const auto& name : names) {
+        uint8_t* contents = nullptr, * compactedContents = nullptr;
+        size_t size, compactedSize;
+
+        repo.getObjectContents(name.c_str(), contents, size);
+        compacted.getObjectContents(name.c_str(), compactedContents, compactedSize);
+
+        REQUIRE(compactedSize == size);
+        REQUIRE(memcmp(contents, compactedContents, size) == 0);
+        free(contents);
+        free(compactedContents);
+
+        std::vector<bleb::ObjectExtent> extents;
+        REQUIRE(compacted.getObjectExtents(name.c_str(), extents));
+        REQUIRE(extents.size() <= 1);
+    }
+
+    // the first stream object comes right after the directory
+    std::vector<bleb::ObjectExtent> firstExtents, secondExtents;
+    REQUIRE(compacted.getObjectExtents("first", firstExtents));
+    REQUIRE(compacted.getObjectExtents("second", secondExtents));
+    REQUIRE(firstExtents[0].location < secondExtents[0].location);
+
+    // not into a non-empty file
+    REQUIRE(!repo.compactTo(&vbio));
+}
+
+TEST_CASE("Repository can be compacted step by step while open", "[Repository]") {
+    bleb::VectorByteIO vbio(0, true);
+
+    std::vector<uint8_t> data(40000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 13);
+
+    auto check = [&](bleb::Repository& repo) {
+        uint8_t* contents = nullptr;
+        size_t size;
+
+        repo.getObjectContents("shrunk", contents, size);
+        REQUIRE(contents != nullptr);
+        REQUIRE(size == 2000);
+        REQUIRE(memcmp(contents, &data[0], size) == 0);
+        free(contents);
+
+        repo.getObjectContents("fragmented", contents, size);
+        REQUIRE(contents != nullptr);
+        REQUIRE(size == data.size());
+        REQUIRE(memcmp(contents, &data[0], size) == 0);
+        free(contents);
+
+        repo.getObjectContents("inline", contents, size);
+        REQUIRE(contents != nullptr);
+        REQUIRE(size == 5);
+        REQUIRE(memcmp(contents, "hello", size) == 0);
+        free(contents);
+    };
+
+    uint64_t sizeBefore;
+
+    {
+        bleb::Repository repo(&vbio);
+        REQUIRE(repo.open(true));
+
+        // free up most of the first stream, so that the spans of the second one can be moved into the hole
+        {
+            auto shrunk = repo.openStream("shrunk", bleb::kStreamCreate);
+            auto fragmented = repo.openStream("fragmented", bleb::kStreamCreate);
+
+            for (size_t pos = 0; pos < data.size(); pos += 1000)
+                REQUIRE(shrunk->setBytesAt(pos, &data[pos], 1000));
+
+            for (size_t pos = 0; pos < data.size(); pos += 1000)
+                REQUIRE(fragmented->setBytesAt(pos, &data[pos], 1000));
+        }
+
+        repo.setObjectContents("shrunk", &data[0], 2000, 0);
+
+        for (int i = 0; i < 50; i++) {
+            char name[20];
+            snprintf(name, sizeof(name), "filler%d", i);
+            repo.setObjectContents(name, name, bleb::kPreferInlinePayload);
+        }
+
+        repo.setObjectContents("inline", "hello", bleb::kPreferInlinePayload);
+        REQUIRE(repo.getFreeSpaceLength() > 0);
+
+        sizeBefore = vbio.getSize();
+
+        // one span at a time
+        REQUIRE(repo.compactStep(1) == 1);
+        REQUIRE(vbio.getSize() < sizeBefore);
+        check(repo);
+
+        int result;
+
+        while ((result = repo.compactStep(4)) == 1)
+            ;
+
+        REQUIRE(result == -1);
+        REQUIRE(vbio.getSize() < sizeBefore - data.size() / 2);
+        check(repo);
+
+        // still usable
+        repo.setObjectContents("after", &data[0], 3000, 0);
+    }
+
+    bleb::Repository repo(&vbio);
+    REQUIRE(repo.open(false));
+    check(repo);
+
+    uint8_t* contents = nullptr;
+    size_t size;
+    repo.getObjectContents("after", contents, size);
+    REQUIRE(contents != nullptr);
+    REQUIRE(size == 3000);
+    REQUIRE(memcmp(contents, &data[0], size) == 0);
+    free(contents);
+}
+
+TEST_CASE("Compaction steps pick up writes made in between", "[Repository]") {
+    bleb::VectorByteIO vbio(0, true);
+    bleb::Repository repo(&vbio);
+
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(20000, 'a');
+
+    // a multi-span stream which will leave a hole behind
+    {
+        auto hole = repo.openStream("hole", bleb::kStreamCreate);
+
+        for (size_t pos = 0; pos < data.size(); pos += 1000)
+            REQUIRE(hole->setBytesAt(pos, &data[pos], 1000));
+    }
+
+    // a stream with room to grow in its only span
+    {
+        auto stream = repo.openStream("stream", bleb::kStreamCreate, 4000);
+        REQUIRE(stream->setBytesAt(0, &data[0], 100));
+    }
+
+    repo.setObjectContents("hole", &data[0], 100, 0);
+
+    REQUIRE(repo.compactStep(0) == 1);
+
+    // not while streams are open
+    {
+        auto stream = repo.openStream("stream", 0);
+        REQUIRE(repo.compactStep(10) == 0);
+        REQUIRE(repo.getErrorKind() == bleb::errNotAllowed);
+    }
+
+    // doesn't allocate anything
+    {
+        const std::vector<uint8_t> more(1000, 'b');
+        auto stream = repo.openStream("stream", 0);
+        REQUIRE(stream->setBytesAt(100, &more[0], more.size()));
+    }
+
+    std::vector<bleb::ObjectExtent> extentsBefore, extentsAfter;
+    REQUIRE(repo.getObjectExtents("stream", extentsBefore));
+
+    while (repo.compactStep(10) == 1)
+        ;
+
+    REQUIRE(repo.getObjectExtents("stream", extentsAfter));
+    REQUIRE(extentsAfter[0].location < extentsBefore[0].location);
+
+    uint8_t* contents = nullptr;
+    size_t size;
+    repo.getObjectContents("stream", contents, size);
+    REQUIRE(contents != nullptr);
+    REQUIRE(size == 1100);
+    REQUIRE(contents[50] == 'a');
+    REQUIRE(contents[500] == 'b');
+    REQUIRE(contents[1099] == 'b');
+    free(contents);
+}
+
+TEST_CASE("Sequential reads are served from a read-ahead buffer", "[RepositoryStream]") {
+    CountingByteIO cbio;
+    bleb::Repository repo(&cbio);
+
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(200000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 11 + i / 1000);
+
+    {
+        auto stream = repo.openStream("stream", bleb::kStreamCreate);
+
+        for (size_t pos = 0; pos < data.size(); pos += 1000)
+            REQUIRE(stream->setBytesAt(pos, &data[pos], 1000));
+    }
+
+    auto stream = repo.openStream("stream", 0);
+
+    std::vector<uint8_t> readBack(data.size());
+    const int readsBefore = cbio.reads;
+
+    for (size_t pos = 0; pos < data.size(); pos += 100)
+        REQUIRE(stream->getBytesAt(pos, &readBack[pos], 100));
+
+    REQUIRE(readBack == data);
+
+    // roughly one read per 64 KiB instead of one per call (plus one per span header)
+    REQUIRE(cbio.reads - readsBefore < 20);
+
+    // a write in between must not leave stale data in the buffer
+    const uint8_t testData[] = u8"Hello, World";
+    uint8_t readBuffer[sizeof(testData)];
+
+    REQUIRE(stream->getBytesAt(0, readBuffer, 10));
+    REQUIRE(stream->getBytesAt(10, readBuffer, 10));
+    REQUIRE(stream->setBytesAt(20, testData, sizeof(testData)));
+    REQUIRE(stream->getBytesAt(20, readBuffer, sizeof(readBuffer)));
+    REQUIRE(memcmp(readBuffer, testData, sizeof(testData)) == 0);
+}
+
+TEST_CASE("Object extents describe where the contents are stored", "[Repository]") {
+    bleb::VectorByteIO vbio(0, true);
+    bleb::Repository repo(&vbio);
+
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(30000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 17);
+
+    {
+        auto stream1 = repo.openStream("stream1", bleb::kStreamCreate);
+        auto stream2 = repo.openStream("stream2", bleb::kStreamCreate);
+
+        for (size_t pos = 0; pos < data.size(); pos += 1000) {
+            REQUIRE(stream1->setBytesAt(pos, &data[pos], 1000));
+            REQUIRE(stream2->setBytesAt(pos, &data[pos], 1000));
+        }
+    }
+
+    const uint8_t inlineData[] = u8"Hello, World";
+    repo.setObjectContents("inline", inlineData, sizeof(inlineData), bleb::kPreferInlinePayload);
+
+    auto gather = [&](const std::vector<bleb::ObjectExtent>& extents) {
+        std::vector<uint8_t> bytes;
+
+        for (const auto& extent : extents) {
+            const uint8_t* view = vbio.viewBytesAt(extent.location, (size_t) extent.length);
+            REQUIRE(view != nullptr);
+            bytes.insert(bytes.end(), view, view + extent.length);
+        }
+
+        return bytes;
+    };
+
+    std::vector<bleb::ObjectExtent> extents;
+
+    REQUIRE(repo.getObjectExtents("stream1", extents));
+    REQUIRE(extents.size() > 1);
+    REQUIRE(gather(extents) == data);
+
+    REQUIRE(repo.getObjectExtents("inline", extents));
+    REQUIRE(gather(extents) == std::vector<uint8_t>(inlineData, inlineData + sizeof(inlineData)));
+
+    REQUIRE(repo.defragmentObject("stream2"));
+    REQUIRE(repo.getObjectExtents("stream2", extents));
+    REQUIRE(extents.size() == 1);
+    REQUIRE(gather(extents) == data);
+
+    REQUIRE(!repo.getObjectExtents("missing", extents));
+}
+
+TEST_CASE("Appending to a long stream jumps straight to its end", "[Repository]") {
+    CountingByteIO cbio;
+    bleb::Repository repo(&cbio);
+
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> log;
+
+    {
+        // interleaving with another stream keeps the spans small and numerous
+        auto stream = repo.openStream("log", bleb::kStreamCreate);
+        auto other = repo.openStream("other", bleb::kStreamCreate);
+
+        for (int i = 0; i < 500; i++) {
+            const uint8_t record[] = {(uint8_t) i, (uint8_t)(i >> 8), 0x55, 0xAA};
+
+            REQUIRE(stream->setBytesAt(stream->getSize(), record, sizeof(record)));
+            REQUIRE(other->setBytesAt(other->getSize(), record, sizeof(record)));
+            log.insert(log.end(), record, record + sizeof(record));
+        }
+    }
+
+    for (int i = 0; i < 20; i++) {
+        const int readsBefore = cbio.reads;
+
+        auto stream = repo.openStream("log", bleb::kStreamAppend);
+        REQUIRE(stream != nullptr);
+
+        const uint8_t record[] = {(uint8_t) i, 0xFF, 0xFF, 0xFF};
+        REQUIRE(stream->setBytesAt(stream->getSize(), record, sizeof(record)));
+        log.insert(log.end(), record, record + sizeof(record));
+
+        // directory lookup, the descriptor and the first span header; the chain isn't walked
+        REQUIRE(cbio.reads - readsBefore < 10);
+    }
+
+    uint8_t* contents = nullptr;
+    size_t size;
+    repo.getObjectContents("log", contents, size);
+    REQUIRE(contents != nullptr);
+    REQUIRE(size == log.size());
+    REQUIRE(memcmp(contents, &log[0], size) == 0);
+    free(contents);
+
+    // random access still works with a gap in the span index
+    {
+        auto stream = repo.openStream("log", bleb::kStreamAppend);
+        uint8_t buffer[8];
+
+        REQUIRE(stream->getBytesAt(1000, buffer, sizeof(buffer)));
+        REQUIRE(memcmp(buffer, &log[1000], sizeof(buffer)) == 0);
+    }
+
+    // after truncation the cached end is gone
+    repo.setObjectContents("log", &log[0], 100, 0);
+
+    {
+        auto stream = repo.openStream("log", bleb::kStreamAppend);
+        REQUIRE(stream->setBytesAt(100, &log[100], 100));
+    }
+
+    repo.getObjectContents("log", contents, size);
+    REQUIRE(contents != nullptr);
+    REQUIRE(size == 200);
+    REQUIRE(memcmp(contents, &log[0], size) == 0);
+    free(contents);
+}
+
+TEST_CASE("Stale streams don't bring back a truncated stream's end", "[Repository]") {
+    bleb::VectorByteIO vbio(0, true);
+    bleb::Repository repo(&vbio);
+
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(40000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 3);
+
+    {
+        auto stream = repo.openStream("log", bleb::kStreamCreate);
+        auto other = repo.openStream("other", bleb::kStreamCreate);
+
+        for (size_t pos = 0; pos < data.size(); pos += 1000) {
+            REQUIRE(stream->setBytesAt(pos, &data[pos], 1000));
+            REQUIRE(other->setBytesAt(pos, &data[pos], 1000));
+        }
+    }
+
+    // cut the stream right where its last span begins
+    std::vector<bleb::ObjectExtent> extents;
+    REQUIRE(repo.getObjectExtents("log", extents));
+    REQUIRE(extents.size() > 1);
+    const size_t truncatedLength = data.size() - (size_t) extents.back().length;
+
+    // a reader walks to the end of the stream...
+    auto reader = repo.openStream("log", 0);
+    REQUIRE(reader != nullptr);
+
+    uint8_t buffer[100];
+    REQUIRE(reader->getBytesAt(data.size() - sizeof(buffer), buffer, sizeof(buffer)));
+
+    // ...while the stream is truncated behind its back, and the released span is taken by another object
+    repo.setObjectContents("log", &data[0], truncatedLength, 0);
+    reader.reset();
+
+    std::vector<uint8_t> filler(data.size(), 0xEE);
+    repo.setObjectContents("filler", &filler[0], filler.size(), 0);
+
+    {
+        auto stream = repo.openStream("log", bleb::kStreamAppend);
+        REQUIRE(stream->setBytesAt(truncatedLength, &data[truncatedLength], data.size() - truncatedLength));
+    }
+
+    uint8_t* contents = nullptr;
+    size_t size;
+    repo.getObjectContents("log", contents, size);
+    REQUIRE(contents != nullptr);
+    REQUIRE(size == data.size());
+    REQUIRE(memcmp(contents, &data[0], size) == 0);
+    free(contents);
+
+    repo.getObjectContents("filler", contents, size);
+    REQUIRE(contents != nullptr);
+    REQUIRE(size == filler.size());
+    REQUIRE(memcmp(contents, &filler[0], size) == 0);
+    free(contents);
+}
+
+TEST_CASE("Span growth can be controlled by a policy", "[Repository]") {
+    bleb::VectorByteIO vbio(0, true);
+    bleb::Repository repo(&vbio);
+
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(100000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 5);
+
+    bleb::GeometricSpanGrowthPolicy doubling(2.0, 1024);
+    bleb::ExactFitSpanGrowthPolicy exactFit;
+
+    auto writeAndCountExtents = [&](const char* name, bleb::SpanGrowthPolicy* policy) {
+        {
+            auto stream = repo.openStream(name, bleb::kStreamCreate, 0, policy);
+            auto other = repo.openStream("other", bleb::kStreamCreate | bleb::kStreamTruncate);
+
+            // interleaved with another stream, so that no span can be extended in place
+            for (size_t pos = 0; pos < data.size(); pos += 1000) {
+                REQUIRE(stream->setBytesAt(pos, &data[pos], 1000));
+                REQUIRE(other->setBytesAt(pos, &data[pos], 1000));
+            }
+        }
+
+        std::vector<bleb::ObjectExtent> extents;
+        REQUIRE(repo.getObjectExtents(name, extents));
+
+        uint8_t* contents = nullptr;
+        size_t size;
+        repo.getObjectContents(name, contents, size);
+        REQUIRE(contents != nullptr);
+        REQUIRE(size == data.size());
+        REQUIRE(memcmp(contents, &data[0], size) == 0);
+        free(contents);
+
+        return extents.size();
+    };
+
+    const size_t defaultSpans = writeAndCountExtents("default", nullptr);
+    const size_t doublingSpans = writeAndCountExtents("doubling", &doubling);
+    const size_t exactSpans = writeAndCountExtents("exact", &exactFit);
+
+    // 1K, 1K, 2K, 4K ... 64K
+    REQUIRE(doublingSpans == 8);
+    REQUIRE(doublingSpans < defaultSpans);
+
+    // one span per write
+    REQUIRE(exactSpans == data.size() / 1000);
+
+    // set for the whole Repository
+    repo.setSpanGrowthPolicy(&doubling);
+    REQUIRE(writeAndCountExtents("doubling2", nullptr) == doublingSpans);
+    repo.setSpanGrowthPolicy(nullptr);
+}
+
+TEST_CASE("Stream capacity can be reserved up front", "[Repository]") {
+    bleb::VectorByteIO vbio(0, true);
+    bleb::Repository repo(&vbio);
+
+    REQUIRE(repo.open(true));
+
+    std::vector<uint8_t> data(100000);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 9);
+
+    auto writeAndCountExtents = [&](const char* name, int mode, uint64_t expectedSize) {
+        {
+            auto stream = repo.openStream(name, mode, expectedSize);
+            auto other = repo.openStream("other", bleb::kStreamCreate | bleb::kStreamTruncate);
+
+            for (size_t pos = 0; pos < data.size(); pos += 4096) {
+                const size_t count = std::min<size_t>(4096, data.size() - pos);
+
+                REQUIRE(stream->setBytesAt(pos, &data[pos], count));
+                REQUIRE(other->setBytesAt(pos, &data[pos], count));
+            }
+        }
+
+        std::vector<bleb::ObjectExtent> extents;
+        REQUIRE(repo.getObjectExtents(name, extents));
+        return extents.size();
+    };
+
+    REQUIRE(writeAndCountExtents("chained", bleb::kStreamCreate, 0) > 1);
+    REQUIRE(writeAndCountExtents("reserved", bleb::kStreamCreate, data.size()) == 1);
+
+    // an existing object gets a bigger first span when truncated
+    REQUIRE(writeAndCountExtents("chained", bleb::kStreamCreate | bleb::kStreamTruncate, data.size()) == 1);
+
+    const uint8_t* view;
+    size_t size;
+    REQUIRE(repo.getObjectView("chained", view, size));
+    REQUIRE(size == data.size());
+    REQUIRE(memcmp(view, &data[0], size) == 0);
+}